@@ -0,0 +1,53 @@
+#include "bytesink.h"
+#include <cerrno>
+#include <unistd.h>
+
+ByteSink::ByteSink(std::string& _memory, size_t buffer_size):
+    memory(&_memory), buffer(new uint8_t[buffer_size]), capacity(buffer_size)
+{
+}
+
+ByteSink::ByteSink(int _fd, size_t buffer_size):
+    fd(_fd), buffer(new uint8_t[buffer_size]), capacity(buffer_size)
+{
+}
+
+ByteSink::ByteSink(write_fn_t _callback, size_t buffer_size):
+    callback(std::move(_callback)), buffer(new uint8_t[buffer_size]), capacity(buffer_size)
+{
+}
+
+ByteSink::~ByteSink() {
+    this->flush();
+    delete[] this->buffer;
+}
+
+// hand bytes to the destination
+void ByteSink::emit(const uint8_t* data, size_t n) {
+    if (this->memory) {
+        this->memory->append((const char*)data, n);
+    } else if (this->fd >= 0) {
+        // after an error the rest of the output is dropped, see get_error()
+        while (n > 0 && !this->error) {
+            ssize_t written = ::write(this->fd, data, n);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                this->error = written < 0 ? errno : EIO;
+                return;
+            }
+            data += written;
+            n -= written;
+        }
+    } else {
+        this->callback(data, n);
+    }
+}
+
+void ByteSink::flush() {
+    if (this->size > 0) {
+        this->emit(this->buffer, this->size);
+        this->size = 0;
+    }
+}
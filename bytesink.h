@@ -0,0 +1,72 @@
+#ifndef BYTE_SINK
+#define BYTE_SINK
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+// a buffered writer of encoded bytes, appending to a string in memory, writing to a file descriptor or calling back
+// bytes are gathered in a large buffer and handed to the destination in chunks, and on flush() or destruction
+class ByteSink {
+public:
+    typedef std::function<void(const uint8_t* data, size_t n)> write_fn_t;
+private:
+    std::string* memory{};
+    int fd{-1};
+    write_fn_t callback;
+    int error{}; // errno of the first failed write to fd
+
+    uint8_t* buffer;
+    size_t capacity;
+    size_t size{};
+
+    void emit(const uint8_t* data, size_t n);
+public:
+    explicit ByteSink(std::string& memory, size_t buffer_size = 1 << 16);
+    explicit ByteSink(int fd, size_t buffer_size = 1 << 16);
+    explicit ByteSink(write_fn_t callback, size_t buffer_size = 1 << 16);
+    ByteSink(const ByteSink&) = delete;
+    ByteSink& operator=(const ByteSink&) = delete;
+    ~ByteSink();
+
+    void put(uint8_t byte) {
+        if (this->size == this->capacity) {
+            this->flush();
+        }
+        this->buffer[this->size++] = byte;
+    }
+    void write(const void* data, size_t n) {
+        if (this->size + n > this->capacity) {
+            this->flush();
+            if (n > this->capacity) {
+                // larger than the buffer, handed over as is
+                this->emit((const uint8_t*)data, n);
+                return;
+            }
+        }
+        memcpy(this->buffer + this->size, data, n);
+        this->size += n;
+    }
+    void write(const std::string& str) {
+        this->write(str.data(), str.size());
+    }
+    void write_u16_le(uint16_t num) {
+        this->put(num & 0xff);
+        this->put(num >> 8);
+    }
+    void write_u16_be(uint16_t num) {
+        this->put(num >> 8);
+        this->put(num & 0xff);
+    }
+    // hand all buffered bytes to the destination
+    void flush();
+    // 0, or the errno of the first write to the file descriptor that failed, which drops all later output
+    // interrupted writes are retried, so check this after the last flush()
+    int get_error() const {
+        return this->error;
+    }
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "bytesource.h"
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ByteSource::ByteSource(std::span<const uint8_t> data):
+    begin(data.data()), end(data.data() + data.size()), cur(data.data())
+{
+}
+
+ByteSource::ByteSource(const char* filename, file_mode_t mode) {
+    if (mode == FILE_MMAP) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                this->mapped = addr;
+                this->mapped_size = st.st_size;
+                this->begin = (const uint8_t*)addr;
+            }
+        }
+        close(fd); // the mapping stays valid after closing
+    } else {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            return;
+        }
+        this->owned = std::string(file.tellg(), ' ');
+        file.seekg(0, std::ios::beg);
+        file.read(&this->owned[0], this->owned.size());
+        this->begin = (const uint8_t*)this->owned.data();
+    }
+    if (this->begin) {
+        this->end = this->begin + (this->mapped ? this->mapped_size : this->owned.size());
+        this->cur = this->begin;
+    }
+}
+
+ByteSource::~ByteSource() {
+    if (this->mapped) {
+        munmap(this->mapped, this->mapped_size);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef BYTE_SOURCE
+#define BYTE_SOURCE
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+
+enum file_mode_t {
+    FILE_READ, // read the whole file into memory
+    FILE_MMAP  // map the file into memory
+};
+
+// a read cursor over bytes in memory, either borrowed from the caller, read from a file or mapped from a file
+// all reads are plain pointer arithmetic
+class ByteSource {
+    const uint8_t* begin{};
+    const uint8_t* end{};
+    const uint8_t* cur{};
+
+    // storages
+    std::string owned;
+    void* mapped{};
+    size_t mapped_size{};
+public:
+    explicit ByteSource(std::span<const uint8_t> data);
+    ByteSource(const char* filename, file_mode_t mode);
+    ByteSource(const ByteSource&) = delete;
+    ByteSource& operator=(const ByteSource&) = delete;
+    ~ByteSource();
+
+    bool is_open() const {
+        return this->begin != nullptr;
+    }
+    bool eof() const {
+        return this->cur >= this->end;
+    }
+    std::span<const uint8_t> data() const {
+        return std::span<const uint8_t>(this->begin, this->end);
+    }
+    size_t size() const {
+        return this->end - this->begin;
+    }
+    size_t remaining() const {
+        return this->end - this->cur;
+    }
+    size_t tellg() const {
+        return this->cur - this->begin;
+    }
+    void seekg(size_t offset) {
+        this->cur = this->begin + (offset < this->size() ? offset : this->size());
+    }
+    void skip(size_t n) {
+        this->cur += n < this->remaining() ? n : this->remaining();
+    }
+    const uint8_t* ptr() const {
+        return this->cur;
+    }
+    // returns -1 at the end of data
+    int peek() const {
+        return this->cur < this->end ? *this->cur : -1;
+    }
+    int get() {
+        return this->cur < this->end ? *this->cur++ : -1;
+    }
+    // copy n bytes out, zero-filling past the end of data
+    void read(char* dst, size_t n) {
+        size_t avail = n < this->remaining() ? n : this->remaining();
+        memcpy(dst, this->cur, avail);
+        memset(dst + avail, 0, n - avail);
+        this->cur += avail;
+    }
+};
+
+#endif
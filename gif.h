@@ -1,6 +1,8 @@
+#ifndef GIF_H
+#define GIF_H
+
 #include <cstdint>
 #include <string>
-#include <map>
 
 // declare bit fields such that msb is at last
 typedef struct {
@@ -59,6 +61,13 @@ typedef union {
     };
 } image_desc_t;
 
+typedef struct {
+    uint16_t l;
+    uint16_t t;
+    uint16_t w;
+    uint16_t h;
+} rect_t;
+
 typedef struct ppm_t {
     std::string header;
     std::string buffer;
@@ -66,46 +75,4 @@ typedef struct ppm_t {
     uint16_t height;
 } ppm_t;
 
-template<typename K, typename V>
-class CodeTable {
-public:
-    std::map<K, V> _map;
-
-    void clear() {
-        _map.clear();
-    }
-
-    void insert(K codes) {
-        size_t next_code = _map.size();
-        _map[codes] = next_code;
-    }
-
-    bool has(K codes) {
-        return _map.contains(codes);
-    }
-
-    size_t size() {
-        return _map.size();
-    }
-
-    V get(K codes) {
-        return _map.at(codes);
-    }
-
-    // for debug
-//    void get_r(V coded) {
-//        for (pair<K, V> kv: _map) {
-//            auto [k, v] = kv;
-//            if (v == coded) {
-//                size_t sz = k.size();
-//                printf("debug %d => ", coded);
-//                for (size_t i = 0; i < sz; i++) {
-//                    printf("%d,", k[i]);
-//                }
-//                printf("\n");
-//            }
-//        }
-//    }
-};
-
-
+#endif
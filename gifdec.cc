@@ -1,25 +1,204 @@
 #include "gifdec.h"
-#include <fstream>
 #include "common.h"
+#include "palette.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <deque>
+#include <future>
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+// lzw code reader
+LzwCodeReader::LzwCodeReader(ByteSource& _file): file(_file) {}
+
+void LzwCodeReader::refill() {
+    while (this->n_bits <= 56) {
+        if (this->block == this->block_end) {
+            if (this->end_of_blocks) {
+                return;
+            }
+            // step into next sub block
+            int sub_block_size = this->file.get();
+            if (sub_block_size <= 0) {
+                this->end_of_blocks = true;
+                return;
+            }
+            this->block = this->file.ptr();
+            this->file.skip(sub_block_size);
+            this->block_end = this->file.ptr(); // clamped if file ends within the sub block
+            if (this->block == this->block_end) {
+                // the file ends right after the length byte
+                this->end_of_blocks = true;
+                return;
+            }
+        }
+        this->bits |= (uint64_t)*this->block++ << this->n_bits;
+        this->n_bits += 8;
+    }
+}
+
+void LzwCodeReader::finish() {
+    while (!this->end_of_blocks) {
+        int sub_block_size = this->file.get();
+        if (sub_block_size <= 0) {
+            this->end_of_blocks = true;
+        } else {
+            this->file.skip(sub_block_size);
+        }
+    }
+    this->block = this->block_end = nullptr;
+    this->n_bits = 0;
+}
+
+// lzw decoder
+void LzwDecoder::init_code_table(uint16_t init_table_size) {
+    for (uint16_t i = 0; i < init_table_size; i++) {
+        this->prefix[i] = 0;
+        this->suffix[i] = i;
+        this->length[i] = 1;
+    }
+}
+
+// write the expansion of a code to dst, walking the prefix chain from the last index to the first
+void LzwDecoder::expand_code(uint16_t code, uint8_t* dst) {
+    uint8_t* ptr = dst + this->length[code];
+    while (ptr != dst) {
+        *--ptr = this->suffix[code];
+        code = this->prefix[code];
+    }
+}
 
-char buf[256]; // a temp buffer for file content
+void LzwDecoder::decode(ByteSource& file, uint16_t w, uint16_t h, const row_fn_t& on_row) {
+    uint8_t min_code_size = file.get();
+    assert(min_code_size < 12 && "lzw decode error: min code size too large");
+
+    uint16_t clear_code = 1 << min_code_size;
+    uint16_t end_code = clear_code + 1;
+    uint16_t table_size = 1 << min_code_size;
+    uint32_t code, prev_code;
+    uint16_t next_code;
+    uint8_t code_size;
+
+    LzwCodeReader reader(file); // reads sub blocks as decoding proceeds
+#ifdef DEBUG
+    size_t n_code = 0;
+#endif
+
+    auto get_next_code = [&]() {
+        uint32_t code = reader.read(code_size);
+#ifdef DEBUG
+        if (n_code < 20) {
+            cerr<<"lzw_code debug: " << n_code << ", " << code << endl;
+        }
+        n_code++;
+#endif
+        return code;
+    };
+
+    // codes are expanded straight into the row buffer, which has room for one row plus the longest expansion
+    // whenever a row is complete it is handed to on_row and the remainder is moved to the front
+    this->row_indexes.resize((size_t)w + LZW_MAX_CODES + 1);
+    uint8_t* row = this->row_indexes.data();
+    size_t fill = 0; // the number of indexes in the row buffer
+    uint16_t y = 0; // the next row to write
+    auto flush_rows = [&]() {
+        if (y >= h || w == 0) {
+            fill = 0; // ignore any excess pixels from a malformed stream
+            return;
+        }
+        size_t pos = 0;
+        while (fill - pos >= w && y < h) {
+            on_row(row + pos, y++, w);
+            pos += w;
+        }
+        if (pos > 0) {
+            memmove(row, row + pos, fill - pos);
+            fill -= pos;
+        }
+    };
+
+    code_size = min_code_size + 1;
+    // first code is clear_code - skip
+    code = get_next_code();
+    if (reader.truncated()) {
+        goto end; // the file ends before any image data
+    }
+    assert(code == clear_code && "lzw decode error: first code not clear_code");
+    init_code_table(table_size);
+clear:
+    next_code = end_code + 1;
+    code_size = min_code_size + 1;
+
+    // extract second code from bytes
+    code = get_next_code();
+    if (code == clear_code) {
+        goto clear;
+    } else if (code == end_code || reader.truncated()) {
+        goto end;
+    }
+    assert(code < table_size && "lzw decode error: first code after clear_code not a root code");
+
+    row[fill++] = code;
+    flush_rows();
+    prev_code = code;
+
+    while (true) {
+        code = get_next_code();
+        if (code == clear_code) {
+            goto clear;
+        } else if (code == end_code || reader.truncated()) {
+            break;
+        }
 
-// util methods
-unsigned char* ptr_in_sub_rect(unsigned char* base, rect_t sub_rect, uint16_t rect_width, uint8_t size, size_t i) {
-    uint16_t x = i % sub_rect.w;
-    uint16_t y = i / sub_rect.w;
-    return base + (rect_width * (sub_rect.t + y) + sub_rect.l + x) * size;
+        // lzw decoding
+        uint8_t first_index;
+        if (code < next_code) {
+            this->expand_code(code, row + fill);
+            first_index = row[fill];
+            fill += this->length[code];
+        } else {
+            assert(code == next_code && "lzw decode error: code not in table");
+            // the code is being defined by this very step - prev_indexes + prev_indexes[0]
+            uint16_t prev_length = this->length[prev_code];
+            this->expand_code(prev_code, row + fill);
+            first_index = row[fill];
+            row[fill + prev_length] = first_index;
+            fill += prev_length + 1;
+        }
+        flush_rows();
+        // some encoder will not emit clear code when the table is full, the table is kept as is
+        if (next_code < LZW_MAX_CODES) {
+            this->prefix[next_code] = prev_code;
+            this->suffix[next_code] = first_index;
+            this->length[next_code] = this->length[prev_code] + 1;
+            next_code++;
+        }
+        prev_code = code;
+        if (next_code == (1 << code_size)) {
+            code_size < 12 && code_size++; // some encoder will not emit clear code (and will not grow code size further)
+        }
+    }
+end:
+    // a stream that ends early leaves a partial row
+    if (fill > 0 && y < h) {
+        on_row(row, y, fill);
+    }
+    reader.finish();
 }
 
 // public methods
-GifDecoder::GifDecoder(const char* filename, pix_fmt_t _pix_fmt):
-    file(filename, ios::binary), pix_fmt(_pix_fmt)
+GifDecoder::GifDecoder(const char* filename, pix_fmt_t _pix_fmt, file_mode_t file_mode):
+    file(filename, file_mode), pix_fmt(_pix_fmt)
 {
     assert(this->file.is_open() && "open file error");
-    this->parse_metadata();
-    uint16_t w = this->get_width();
-    uint16_t h = this->get_height();
-    this->buffer = new unsigned char[w * h * 4];
+    this->init();
+}
+
+GifDecoder::GifDecoder(std::span<const uint8_t> data, pix_fmt_t _pix_fmt):
+    file(data), pix_fmt(_pix_fmt)
+{
+    this->init();
 }
 
 GifDecoder::~GifDecoder() {
@@ -27,47 +206,287 @@ GifDecoder::~GifDecoder() {
 }
 
 uint16_t GifDecoder::get_width() const {
-    return this->lsd.w;
+    return ((uint32_t)this->lsd.w + (1 << this->scale_shift) - 1) >> this->scale_shift;
 }
 
 uint16_t GifDecoder::get_height() const {
-    return this->lsd.h;
+    return ((uint32_t)this->lsd.h + (1 << this->scale_shift) - 1) >> this->scale_shift;
 }
 
 void GifDecoder::loop() {
-    this->file.seekg(this->file_loop_offset, ios::beg);
-    memset(this->buffer, 255, this->lsd.w * this->lsd.h * 4); // set to white
+    this->alloc_canvas();
+    this->file.seekg(this->file_loop_offset);
+    this->fill_rect(this->canvas_rect()); // set to background
     this->lct.clear(); // when looping remember to reset local color table
+    this->gce = gce_t{};
+    this->frame_cursor = 0;
+    this->prev_disposal = 0;
+    this->dirty_all = true;
+}
+
+void GifDecoder::set_output(unsigned char* _canvas, size_t _stride, pix_fmt_t _pix_fmt) {
+    this->pix_fmt = _pix_fmt;
+    if (_canvas) {
+        assert(_stride >= (size_t)this->get_width() * this->bytes_per_pixel() && "canvas stride smaller than a row");
+    }
+    // taken by alloc_canvas(), which falls back to the own buffer for nullptr
+    // and allocates it again when pixels of the new pix_fmt are larger
+    this->output_canvas = _canvas;
+    this->output_stride = _stride;
+    this->canvas = nullptr;
+    // snapshots are in the layout of the previous canvas
+    this->keyframes.clear();
+    this->clear_frame_cache();
+    this->loop();
+}
+
+void GifDecoder::set_scale(uint8_t shift) {
+    assert(shift <= 3 && "scale must be 1, 1/2, 1/4 or 1/8");
+    this->scale_shift = shift;
+    // the own canvas is allocated again at the new size
+    bool own_canvas = this->canvas == this->buffer;
+    delete[] this->buffer;
+    this->buffer = nullptr;
+    this->buffer_size = 0;
+    if (own_canvas) {
+        this->canvas = nullptr;
+    }
+    if (this->output_canvas) {
+        assert(this->output_stride >= (size_t)this->get_width() * this->bytes_per_pixel() && "canvas stride smaller than a row");
+    }
+    this->keyframes.clear();
+    this->clear_frame_cache();
+    this->loop();
+}
+
+void GifDecoder::set_row_sink(row_sink_t sink, bool with_canvas) {
+    this->row_sink = std::move(sink);
+    if (with_canvas == this->use_canvas) {
+        return;
+    }
+    this->use_canvas = with_canvas;
+    if (!with_canvas && this->canvas == this->buffer) {
+        delete[] this->buffer;
+        this->buffer = nullptr;
+        this->buffer_size = 0;
+    }
+    // a canvas from set_output() is kept, and taken again by alloc_canvas() when the canvas is back on
+    this->canvas = nullptr;
+    this->keyframes.clear();
+    this->clear_frame_cache();
+    this->loop();
+}
+
+void GifDecoder::set_max_size(uint16_t max_w, uint16_t max_h) {
+    uint8_t shift = 0;
+    while (shift < 3 && (((uint32_t)this->lsd.w + (1 << shift) - 1) >> shift > max_w || ((uint32_t)this->lsd.h + (1 << shift) - 1) >> shift > max_h)) {
+        shift++;
+    }
+    this->set_scale(shift);
+}
+
+int GifDecoder::get_loop_count() const {
+    return this->loop_count;
+}
+
+unsigned char* GifDecoder::get_canvas() const {
+    return this->canvas;
+}
+
+size_t GifDecoder::get_stride() const {
+    return this->stride;
+}
+
+rect_t GifDecoder::get_dirty_rect() const {
+    return this->dirty_rect;
+}
+
+uint16_t GifDecoder::get_delay() const {
+    return this->frame_delay;
+}
+
+const string& GifDecoder::get_color_table() const {
+    return this->frame_color_table;
+}
+
+size_t GifDecoder::get_frame_cursor() const {
+    return this->frame_cursor;
+}
+
+const vector<frame_info_t>& GifDecoder::scan_frames() {
+    if (this->frame_index_built) {
+        return this->frame_index;
+    }
+    // the decoder's own position and gce are restored after scanning
+    size_t saved_offset = this->file.tellg();
+    gce_t saved_gce = this->gce;
+
+    this->file.seekg(this->file_loop_offset);
+    this->gce = gce_t{};
+    size_t frame_offset = this->file.tellg();
+    while (!this->file.eof() && this->file.peek() != 0x3b) {
+        const uint8_t* block = this->file.ptr();
+        uint8_t label = this->file.remaining() >= 2 ? block[1] : 0;
+        if (block[0] == 0x21 && label == 0xf9) {
+            this->parse_gce();
+        } else if (block[0] == 0x21 && label == 0xff) {
+            this->parse_application_extension();
+        } else if (block[0] == 0x21) {
+            this->skip_extension();
+        } else if (block[0] == 0x2c) {
+            frame_info_t info{};
+            info.offset = frame_offset;
+            info.image_offset = this->file.tellg();
+            info.gce = this->gce;
+            this->file.skip(1);
+            this->file.read((char*)info.image_desc.raw, sizeof(info.image_desc.raw));
+            if (info.image_desc.packed.has_lct) {
+                this->file.skip((1 << (info.image_desc.packed.lct_sz + 1)) * 3);
+            }
+            info.data_offset = this->file.tellg();
+            this->file.skip(1); // lzw min code size
+            this->skip_sub_blocks();
+            info.end_offset = this->file.tellg();
+            this->frame_index.push_back(info);
+            this->gce = gce_t{};
+            frame_offset = this->file.tellg();
+        } else {
+            assert(false && "unknown block type");
+        }
+    }
+    this->frame_index_built = true;
+
+    this->file.seekg(saved_offset);
+    this->gce = saved_gce;
+    return this->frame_index;
+}
+
+gif_probe_t GifDecoder::probe() {
+    const vector<frame_info_t>& index = this->scan_frames();
+    gif_probe_t probe{ this->lsd.w, this->lsd.h, index.size(), {}, 0, this->loop_count };
+    probe.delays.reserve(index.size());
+    for (const frame_info_t& info: index) {
+        probe.delays.push_back(info.gce.delay);
+        probe.duration += info.gce.delay;
+    }
+    return probe;
+}
+
+void GifDecoder::set_keyframe_interval(size_t n) {
+    this->keyframe_interval = n;
+}
+
+void GifDecoder::set_frame_cache(size_t budget) {
+    this->frame_cache_budget = budget;
+    if (budget == 0) {
+        this->clear_frame_cache();
+    }
+}
+
+frame_cache_stats_t GifDecoder::get_frame_cache_stats() const {
+    return this->frame_cache_stats;
+}
+
+void GifDecoder::seek_to_frame(size_t n) {
+    const vector<frame_info_t>& index = this->scan_frames();
+    assert(n < index.size() && "seek past the last frame");
+
+    // the closest keyframe at or before n
+    const keyframe_t* keyframe = nullptr;
+    for (const keyframe_t& k: this->keyframes) {
+        if (k.frame > n) break;
+        keyframe = &k;
+    }
+    // frames decoded so far are [0, frame_cursor), continue from there if it is not further from n than the keyframe
+    bool can_continue = this->frame_cursor > 0 && this->frame_cursor - 1 <= n;
+    if (can_continue && (!keyframe || keyframe->frame <= this->frame_cursor - 1)) {
+        // keep decoding from the current frame
+    } else if (keyframe) {
+        this->restore_rect(this->canvas_rect(), keyframe->canvas);
+        this->file.seekg(keyframe->next_offset);
+        this->lct.clear();
+        this->gce = gce_t{};
+        this->frame_cursor = keyframe->frame + 1;
+        this->prev_disposal = keyframe->disposal;
+        this->prev_rect = keyframe->rect;
+        this->prev_restore = keyframe->restore;
+        this->dirty_all = true;
+    } else {
+        this->loop();
+    }
+    while (this->frame_cursor <= n) {
+        bool eof = this->decode_frame();
+        assert(!eof && "unexpected end of file while seeking");
+    }
 }
 
 bool GifDecoder::decode_frame() {
+    this->alloc_canvas();
+    if (this->replay_cached_frame()) {
+        return false;
+    }
     // while not reaching end of gif file
-    while (this->file.peek() != 0x3b) {
+    while (!this->file.eof() && this->file.peek() != 0x3b) {
         // read block type
-        this->file.read(buf, 2);
-        this->file.seekg(-2, ios::cur);
+        const uint8_t* block = this->file.ptr();
+        uint8_t label = this->file.remaining() >= 2 ? block[1] : 0;
         // case0: graphic control extension
-        if (!memcmp(buf, "\x21\xf9", 2)) {
+        if (block[0] == 0x21 && label == 0xf9) {
             this->parse_gce();
         // case1: application extension (todo more)
-        } else if (!memcmp(buf, "\x21\xff", 2)) {
+        } else if (block[0] == 0x21 && label == 0xff) {
             this->parse_application_extension();
         // case2: comment extension
-        } else if (!memcmp(buf, "\x21\xfe", 2)) {
+        } else if (block[0] == 0x21 && label == 0xfe) {
             this->parse_comment_extension();
-        // case3: image descriptor - local color table - image data
-        } else if (buf[0] == '\x2c') {
+        // case3: other extensions (plain text etc.) are skipped
+        } else if (block[0] == 0x21) {
+            this->skip_extension();
+        // case4: image descriptor - local color table - image data
+        } else if (block[0] == 0x2c) {
+            if (this->frame_cache_budget > 0 && !this->row_sink) {
+                this->frame_cache_stats.misses++;
+            }
             this->decode_frame_internal();
             return false;
 
             // if (!dec_stat.eof) dec_stat.num_of_frames++; // todo
             // return true;
+        } else {
+            assert(false && "unknown block type");
         }
     }
     return true;
 }
 
 // private methods
+void GifDecoder::init() {
+    this->parse_metadata();
+}
+
+// the canvas is only needed for decoding, so probing a file never allocates it
+void GifDecoder::alloc_canvas() {
+    if (this->canvas || !this->use_canvas) {
+        return;
+    }
+    uint16_t w = this->get_width();
+    uint16_t h = this->get_height();
+    if (this->output_canvas) {
+        this->canvas = this->output_canvas;
+        this->stride = this->output_stride;
+        this->fill_rect(this->canvas_rect()); // set to background
+        return;
+    }
+    this->stride = (size_t)w * this->bytes_per_pixel();
+    if (this->buffer_size < this->stride * h) {
+        delete[] this->buffer;
+        this->buffer_size = this->stride * h;
+        this->buffer = new unsigned char[this->buffer_size];
+    }
+    this->canvas = this->buffer;
+    this->fill_rect(this->canvas_rect()); // set to background
+}
+
 void GifDecoder::parse_metadata() {
     // header
     this->parse_header();
@@ -77,193 +496,464 @@ void GifDecoder::parse_metadata() {
 }
 
 void GifDecoder::parse_header() {
-    read_assert_str_equal(this->file, buf, "GIF89a", "not gif89 file");
+    read_assert_str_equal(this->file, this->buf, "GIF89a", "not gif89 file");
 }
 
 void GifDecoder::parse_lsd_and_set_gct() {
     this->file.read((char*)this->lsd.raw, sizeof(this->lsd.raw));
     // global color table
     uint16_t gct_real_size = (1 << (this->lsd.packed.gct_sz + 1)) * 3;
-    this->gct = string(gct_real_size, ' ');
-    file.read(&this->gct[0], gct_real_size);
+    if (this->lsd.packed.has_gct) {
+        this->gct = string((const char*)this->file.ptr(), min((size_t)gct_real_size, this->file.remaining()));
+        this->gct.resize(gct_real_size, 0);
+        this->file.skip(gct_real_size);
+    } else {
+        this->gct = string(gct_real_size, 0);
+    }
 }
 
 void GifDecoder::parse_gce() {
-    read_assert_str_equal(this->file, buf, "\x21\xf9\x04", "graphic control extension header error");
+    read_assert_str_equal(this->file, this->buf, "\x21\xf9\x04", "graphic control extension header error");
     this->file.read((char*)this->gce.raw, sizeof(this->gce.raw));
-    read_assert_str_equal(this->file, buf, "\x00", "graphic control extension block terminal error");
+    read_assert_str_equal(this->file, this->buf, "\x00", "graphic control extension block terminal error");
 }
 
 void GifDecoder::parse_application_extension() {
     // NETSCAPE or other
-    read_assert_str_equal(this->file, buf, "\x21\xff\x0b", "netscape looping application extension header error");
-    this->file.seekg(11, ios::cur); // skip identifier and authentication code
-    
-    uint8_t block_size;
-    this->file.get((char&)block_size);
-    this->file.seekg(block_size, ios::cur);
-    read_assert_num_equal(this->file, buf, 0, "application extension block not terminated with 0");
+    read_assert_str_equal(this->file, this->buf, "\x21\xff\x0b", "netscape looping application extension header error");
+    this->file.read(this->buf, 11); // identifier and authentication code
+    if (memcmp(this->buf, "NETSCAPE2.0", 11) && memcmp(this->buf, "ANIMEXTS1.0", 11)) {
+        this->skip_sub_blocks();
+        return;
+    }
+    // looping sub block - 0x01, then the loop count in little endian
+    string bytes = this->bytes_from_all_sub_blocks();
+    if (bytes.size() >= 3 && bytes[0] == 1) {
+        this->loop_count = (uint8_t)bytes[1] | (uint8_t)bytes[2] << 8;
+    }
 }
 
 void GifDecoder::parse_comment_extension() {
-    read_assert_str_equal(this->file, buf, "\x21\xfe", "comment extension header error");
+    read_assert_str_equal(this->file, this->buf, "\x21\xfe", "comment extension header error");
     string bytes = this->bytes_from_all_sub_blocks(); // packed bytes from all sub blocks
     // if (!dec_stat.eof) { // todo
     //     cerr << "Comment block at offset " << file.tellg() << " with content: " << bytes <<endl;
     // }
 }
 
+void GifDecoder::skip_extension() {
+    this->file.skip(2); // extension introducer and label
+    this->skip_sub_blocks();
+}
+
 string GifDecoder::bytes_from_all_sub_blocks() {
     string bytes;
     // while we are not at the end of all sub blocks
-    while (this->file.peek() != 0x00) {
-        uint8_t sub_block_size;
-        this->file.get((char&)sub_block_size);
-        string sub_block_data(sub_block_size, ' ');
-        // get sub block data
-        this->file.read(&sub_block_data[0], sub_block_size);
-        bytes.append(sub_block_data);
-    }
-    this->file.seekg(1, ios::cur); // skip end of block
+    int sub_block_size;
+    while ((sub_block_size = this->file.get()) > 0) {
+        bytes.append((const char*)this->file.ptr(), min((size_t)sub_block_size, this->file.remaining()));
+        this->file.skip(sub_block_size);
+    }
     return bytes;
 }
 
-void GifDecoder::decode_frame_internal() {
-    // if disposal needed, clear the framebuffer
-    if (this->gce.packed.disposal == 2) {
-        memset(this->buffer, 255, this->lsd.w * this->lsd.h * 4); // set to white
+void GifDecoder::skip_sub_blocks() {
+    // jump over each sub block by its length byte, until the block terminator
+    int sub_block_size;
+    while ((sub_block_size = this->file.get()) > 0) {
+        this->file.skip(sub_block_size);
     }
+}
+
+void GifDecoder::decode_frame_internal() {
+    this->apply_disposal();
     // image descriptor
-    read_assert_str_equal(this->file, buf, "\x2c", "image descriptor header error");
+    read_assert_str_equal(this->file, this->buf, "\x2c", "image descriptor header error");
     this->file.read((char*)this->image_desc.raw, sizeof(this->image_desc.raw));
 
     if (this->image_desc.packed.has_lct) {
         uint16_t lct_real_size = (1 << (this->image_desc.packed.lct_sz + 1)) * 3;
-        this->lct = string(lct_real_size, ' ');
+        this->lct = string(lct_real_size, 0);
         this->file.read(&this->lct[0], lct_real_size);
     }
+    this->begin_frame();
 
     // lzw-encoded block
-    this->lzw_unpack_decode();
+    this->lzw.decode(this->file, this->image_desc.w, this->image_desc.h, [this](const uint8_t* indexes, uint16_t y, uint16_t n) {
+        this->write_row(indexes, y, n);
+    });
+    this->finish_frame();
 }
 
-void GifDecoder::init_code_table(uint16_t init_table_size) {
-    this->code_table.clear();
-    for (uint16_t i = 0; i < init_table_size; i++) {
-        this->code_table[this->code_table.size()] = u8string(1, i);
+uint8_t GifDecoder::bytes_per_pixel() const {
+    return this->pix_fmt == RGB ? 3 : this->pix_fmt == INDEXED ? 1 : 4;
+}
+
+// what the canvas is cleared and disposed to, every byte of a white pixel, or the background color index
+uint8_t GifDecoder::background() const {
+    return this->pix_fmt == INDEXED ? this->lsd.bci : 255;
+}
+
+// a rect of the gif canvas mapped to the canvas pixels sampled inside it
+rect_t GifDecoder::scale_rect(rect_t rect) const {
+    uint8_t shift = this->scale_shift;
+    uint32_t round = (1 << shift) - 1;
+    uint16_t l = ((uint32_t)rect.l + round) >> shift;
+    uint16_t t = ((uint32_t)rect.t + round) >> shift;
+    uint16_t r = ((uint32_t)rect.l + rect.w + round) >> shift;
+    uint16_t b = ((uint32_t)rect.t + rect.h + round) >> shift;
+    return { l, t, (uint16_t)(r - l), (uint16_t)(b - t) };
+}
+
+rect_t GifDecoder::canvas_rect() const {
+    return { 0, 0, this->get_width(), this->get_height() };
+}
+
+// the image descriptor rect clipped to the gif canvas, in canvas pixels
+rect_t GifDecoder::frame_rect() const {
+    uint16_t l = min(this->image_desc.l, this->lsd.w);
+    uint16_t t = min(this->image_desc.t, this->lsd.h);
+    uint16_t w = min<uint32_t>(this->image_desc.w, this->lsd.w - l);
+    uint16_t h = min<uint32_t>(this->image_desc.h, this->lsd.h - t);
+    return this->scale_rect({ l, t, w, h });
+}
+
+void GifDecoder::fill_rect(rect_t rect) {
+    if (!this->canvas) {
+        return;
+    }
+    uint8_t bpp = this->bytes_per_pixel();
+    for (uint16_t y = rect.t; y < rect.t + rect.h; y++) {
+        memset(this->canvas + (size_t)y * this->stride + (size_t)rect.l * bpp, this->background(), (size_t)rect.w * bpp);
     }
 }
 
-void GifDecoder::lzw_unpack_decode() {
-    uint8_t min_code_size;
-    this->file.get((char&)min_code_size);
+void GifDecoder::save_rect(rect_t rect, string& out) const {
+    if (!this->canvas) {
+        out.clear();
+        return;
+    }
+    uint8_t bpp = this->bytes_per_pixel();
+    size_t row_size = (size_t)rect.w * bpp;
+    out.resize(row_size * rect.h);
+    for (uint16_t y = 0; y < rect.h; y++) {
+        memcpy(&out[y * row_size], this->canvas + (size_t)(rect.t + y) * this->stride + (size_t)rect.l * bpp, row_size);
+    }
+}
 
-    uint16_t clear_code = 1 << min_code_size;
-    uint16_t end_code = clear_code + 1;
-    uint16_t table_size = 1 << min_code_size;
-    uint32_t n_bit = 0;
-    uint32_t code, prev_code;
-    uint8_t code_size;
-    u8string indexes, prev_indexes, new_indexes;
+void GifDecoder::restore_rect(rect_t rect, const string& in) {
+    if (!this->canvas) {
+        return;
+    }
+    uint8_t bpp = this->bytes_per_pixel();
+    size_t row_size = (size_t)rect.w * bpp;
+    for (uint16_t y = 0; y < rect.h; y++) {
+        memcpy(this->canvas + (size_t)(rect.t + y) * this->stride + (size_t)rect.l * bpp, &in[y * row_size], row_size);
+    }
+}
 
-    string bytes = this->bytes_from_all_sub_blocks(); // packed bytes from all sub blocks
-#ifdef DEBUG
-    size_t n_code = 0;
-#endif
+rect_t union_rect(rect_t a, rect_t b) {
+    if (a.w == 0 || a.h == 0) return b;
+    if (b.w == 0 || b.h == 0) return a;
+    uint16_t l = min(a.l, b.l);
+    uint16_t t = min(a.t, b.t);
+    uint16_t r = max(a.l + a.w, b.l + b.w);
+    uint16_t bottom = max(a.t + a.h, b.t + b.h);
+    return { l, t, (uint16_t)(r - l), (uint16_t)(bottom - t) };
+}
 
-    auto get_next_code = [&]() {
-        // the bit position - amount to shift left
-        uint32_t start_shift = n_bit % 8;
-        // the index position of bytestream
-        uint32_t start_index = n_bit / 8;
-        uint32_t end_index = (n_bit + code_size) / 8;
-
-        uint32_t code = 0;
-        for (uint32_t j = 0; j <= end_index - start_index; j++) {
-            code |= ((unsigned char)bytes[start_index + j] << (8 * j));
-        }
-        // right shift to remove low bits
-        code >>= start_shift;
-        // mask to remove high bits
-        uint32_t mask = (1 << (code_size)) - 1;
-        code &= mask;
-        n_bit += code_size;
-#ifdef DEBUG
-        if (n_code < 20) {
-            cerr<<"lzw_code debug: " << n_code << ", " << code << endl;
-        }
-        n_code++;
-#endif
-        return code;
+// dispose the last frame's rect as its gce asked, before the next frame is drawn
+void GifDecoder::apply_disposal() {
+    this->dirty_rect = {};
+    if (this->prev_disposal == 2) {
+        // restore to background
+        this->fill_rect(this->prev_rect);
+        this->dirty_rect = this->prev_rect;
+    } else if (this->prev_disposal == 3) {
+        // restore to previous
+        this->restore_rect(this->prev_rect, this->prev_restore);
+        this->dirty_rect = this->prev_rect;
+    }
+    this->prev_disposal = 0;
+}
+
+// called once the image descriptor and local color table are known, right before drawing
+void GifDecoder::begin_frame() {
+    if (this->gce.packed.disposal == 3) {
+        // only the area this frame covers is kept for restoring
+        this->save_rect(this->frame_rect(), this->prev_restore);
+    }
+    this->init_palette();
+}
+
+void GifDecoder::finish_frame() {
+    rect_t rect = this->frame_rect();
+    if (this->dirty_all) {
+        this->dirty_rect = this->canvas_rect();
+        this->dirty_all = false;
+    } else {
+        this->dirty_rect = union_rect(this->dirty_rect, rect);
+    }
+    this->prev_disposal = this->gce.packed.disposal;
+    this->prev_rect = rect;
+    this->frame_delay = this->gce.delay;
+
+    // gce and local color table only apply to this frame
+    this->gce = gce_t{};
+    this->lct.clear();
+    this->save_keyframe();
+    this->save_cached_frame();
+    this->frame_cursor++;
+}
+
+// composite a frame whose lzw data was already decoded into a plane of color indexes
+void GifDecoder::composite_frame(const frame_info_t& info, const uint8_t* indexes, size_t n_indexes) {
+    this->gce = info.gce;
+    this->apply_disposal();
+    this->image_desc = info.image_desc;
+    if (this->image_desc.packed.has_lct) {
+        uint16_t lct_real_size = (1 << (this->image_desc.packed.lct_sz + 1)) * 3;
+        this->file.seekg(info.image_offset + sizeof(this->image_desc.raw) + 1);
+        this->lct = string(lct_real_size, 0);
+        this->file.read(&this->lct[0], lct_real_size);
+    }
+    this->begin_frame();
+
+    uint16_t w = this->image_desc.w;
+    for (uint16_t y = 0; w > 0 && (size_t)y * w < n_indexes; y++) {
+        this->write_row(indexes + (size_t)y * w, y, min<size_t>(w, n_indexes - (size_t)y * w));
+    }
+    this->file.seekg(info.end_offset);
+    this->finish_frame();
+}
+
+void GifDecoder::decode_frames_parallel(size_t n_threads, const std::function<void(size_t frame)>& on_frame) {
+    const vector<frame_info_t>& index = this->scan_frames();
+    this->alloc_canvas();
+    ThreadPool pool(n_threads);
+
+    typedef struct {
+        vector<uint8_t> indexes;
+        size_t n_indexes; // less than w * h for a truncated stream
+    } frame_indexes_t;
+
+    // lzw runs ahead of compositing by a bounded window of frames, so only that many index planes are alive
+    std::span<const uint8_t> data = this->file.data();
+    std::deque<std::future<frame_indexes_t>> pending;
+    size_t window = pool.size() * 2;
+    size_t next = this->frame_cursor;
+    auto submit = [&](const frame_info_t& info) {
+        pending.push_back(pool.submit([data, &info]() {
+            uint16_t w = info.image_desc.w;
+            frame_indexes_t plane{ vector<uint8_t>((size_t)w * info.image_desc.h), 0 };
+            ByteSource file(data);
+            file.seekg(info.data_offset);
+            LzwDecoder lzw;
+            lzw.decode(file, w, info.image_desc.h, [&](const uint8_t* indexes, uint16_t y, uint16_t n) {
+                memcpy(plane.indexes.data() + (size_t)y * w, indexes, n);
+                plane.n_indexes = (size_t)y * w + n;
+            });
+            return plane;
+        }));
     };
 
-    size_t i = 0; // the number of written bytes to decoded_frame
-    const char* color_table = this->lct.empty() ? this->gct.data() : this->lct.data(); // to use local or global color table
-    auto write_to_decoded_frame = [&](const u8string& _indexes) {
-        for (auto index: _indexes) {
-            rect_t rect = { this->image_desc.l, this->image_desc.t, this->image_desc.w, this->image_desc.h };
-
-            // skip on transparent index
-            if (index == this->gce.tran_index) {
-            // ARGB, write one byte for alpha and 3 bytes for rgb
-            } else if (this->pix_fmt == ARGB) {
-                unsigned char* ptr = ptr_in_sub_rect(this->buffer, rect, this->lsd.w, 4, i);
-                *ptr = 255;
-                memcpy(ptr + 1, color_table + index * 3, 3);
-            // RGBA, write 3 bytes for rgb and one byte for alpha 
-            } else if (this->pix_fmt == RGBA) {
-                unsigned char* ptr = ptr_in_sub_rect(this->buffer, rect, this->lsd.w, 4, i);
-                memcpy(ptr, color_table + index * 3, 3);
-                *(ptr + 3) = 255;
-            // RGB, write 3 bytes for rgb
-            } else if (this->pix_fmt == RGB) {
-                unsigned char* ptr = ptr_in_sub_rect(this->buffer, rect, this->lsd.w, 3, i);
-                memcpy(ptr, color_table + index * 3, 3);
-            }
-            i++;
+    for (size_t i = this->frame_cursor; i < index.size(); i++) {
+        while (next < index.size() && next < i + window) {
+            submit(index[next++]);
         }
-    };
+        frame_indexes_t plane = pending.front().get();
+        pending.pop_front();
+        this->composite_frame(index[i], plane.indexes.data(), plane.n_indexes);
+        on_frame(i);
+    }
+}
 
-    code_size = min_code_size + 1;
-    // first code is clear_code - skip
-    code = get_next_code();
-    assert(code == clear_code && "lzw decode error: first code not clear_code");
-clear:
-    init_code_table(table_size);
-    code_table[clear_code] = u8string(1, clear_code);
-    code_table[end_code] = u8string(1, end_code);
-    code_size = min_code_size + 1;
+void GifDecoder::save_keyframe() {
+    if (!this->canvas || this->keyframe_interval == 0 || this->frame_cursor % this->keyframe_interval != 0) {
+        return;
+    }
+    if (!this->keyframes.empty() && this->keyframes.back().frame >= this->frame_cursor) {
+        return; // already saved on an earlier pass
+    }
+    keyframe_t keyframe;
+    keyframe.frame = this->frame_cursor;
+    keyframe.next_offset = this->file.tellg();
+    this->save_rect(this->canvas_rect(), keyframe.canvas);
+    keyframe.disposal = this->prev_disposal;
+    keyframe.rect = this->prev_rect;
+    keyframe.restore = this->prev_restore;
+    this->keyframes.push_back(std::move(keyframe));
+}
 
-    // extract second code from bytes
-    code = get_next_code();
+void GifDecoder::save_cached_frame() {
+    // frames replayed from the cache would skip the row sink
+    if (!this->canvas || this->frame_cache_budget == 0 || this->row_sink) {
+        return;
+    }
+    if (this->frame_cursor < this->frame_cache.size() && this->frame_cache[this->frame_cursor].cached) {
+        return; // already saved on an earlier pass
+    }
+    // the dirty rect covers every pixel the frame changed from the frame before, including its disposal
+    size_t bytes = sizeof(cached_frame_t) + (size_t)this->dirty_rect.w * this->dirty_rect.h * this->bytes_per_pixel()
+        + (this->prev_disposal == 3 ? this->prev_restore.size() : 0) + (this->pix_fmt == INDEXED ? this->frame_color_table.size() : 0);
+    if (this->frame_cache_stats.bytes + bytes > this->frame_cache_budget) {
+        return;
+    }
+    if (this->frame_cursor >= this->frame_cache.size()) {
+        this->frame_cache.resize(this->frame_cursor + 1);
+    }
+    cached_frame_t& frame = this->frame_cache[this->frame_cursor];
+    frame.cached = true;
+    frame.next_offset = this->file.tellg();
+    frame.dirty = this->dirty_rect;
+    this->save_rect(frame.dirty, frame.pixels);
+    frame.delay = this->frame_delay;
+    frame.disposal = this->prev_disposal;
+    frame.rect = this->prev_rect;
+    if (frame.disposal == 3) {
+        frame.restore = this->prev_restore;
+    }
+    if (this->pix_fmt == INDEXED) {
+        frame.color_table = this->frame_color_table;
+    }
+    this->frame_cache_stats.frames++;
+    this->frame_cache_stats.bytes += bytes;
+}
 
-    indexes = code_table[code];
-    write_to_decoded_frame(indexes);
-    prev_code = code;
+// draw the next frame from the cache, as if it was decoded
+bool GifDecoder::replay_cached_frame() {
+    if (this->row_sink || this->frame_cursor >= this->frame_cache.size() || !this->frame_cache[this->frame_cursor].cached) {
+        return false;
+    }
+    const cached_frame_t& frame = this->frame_cache[this->frame_cursor];
+    this->restore_rect(frame.dirty, frame.pixels);
+    if (this->dirty_all) {
+        this->dirty_rect = this->canvas_rect();
+        this->dirty_all = false;
+    } else {
+        this->dirty_rect = frame.dirty;
+    }
+    this->frame_delay = frame.delay;
+    this->prev_disposal = frame.disposal;
+    this->prev_rect = frame.rect;
+    if (frame.disposal == 3) {
+        this->prev_restore = frame.restore;
+    }
+    if (this->pix_fmt == INDEXED) {
+        this->frame_color_table = frame.color_table;
+    }
+    this->file.seekg(frame.next_offset);
+    this->gce = gce_t{};
+    this->lct.clear();
+    this->save_keyframe();
+    this->frame_cursor++;
+    this->frame_cache_stats.hits++;
+    return true;
+}
 
-    while (true) {
-        code = get_next_code();
-        if (code == clear_code) {
-            goto clear;
-        } else if (code == end_code) {
+void GifDecoder::clear_frame_cache() {
+    this->frame_cache.clear();
+    this->frame_cache.shrink_to_fit();
+    this->frame_cache_stats.frames = 0;
+    this->frame_cache_stats.bytes = 0;
+}
+
+// expand the color table of the frame into output pixels, so that each index costs one table load
+void GifDecoder::init_palette() {
+    const string& color_table = this->lct.empty() ? this->gct : this->lct; // to use local or global color table
+    size_t n_color = min(color_table.size() / 3, (size_t)256);
+    this->frame_color_table.assign(color_table, 0, n_color * 3);
+    this->frame_color_table.resize(256 * 3, 0);
+    memset(this->palette, 0, sizeof(this->palette));
+    for (size_t i = 0; i < 256; i++) {
+        uint8_t rgb[3] = { 0, 0, 0 }; // indexes past the color table are black
+        if (i < n_color) {
+            memcpy(rgb, color_table.data() + i * 3, 3);
+        }
+        uint8_t* entry = (uint8_t*)(this->palette + i);
+        if (this->pix_fmt == ARGB) {
+            // ARGB, one byte for alpha and 3 bytes for rgb
+            entry[0] = 255;
+            memcpy(entry + 1, rgb, 3);
+        } else if (this->pix_fmt == RGBA) {
+            // RGBA, 3 bytes for rgb and one byte for alpha
+            memcpy(entry, rgb, 3);
+            entry[3] = 255;
+        } else {
+            // RGB, 3 bytes for rgb
+            memcpy(entry, rgb, 3);
+        }
+    }
+    this->tran_index = this->gce.packed.transparent ? this->gce.tran_index : -1;
+}
+
+// the frame row (relative to the image descriptor) of the i-th row in the lzw data
+// interlaced frames store every 8th row from row 0, every 8th row from row 4, every 4th row from row 2, then odd rows
+uint16_t GifDecoder::interlaced_row(uint16_t i, uint8_t& pass) const {
+    uint16_t h = this->image_desc.h;
+    if (!this->image_desc.packed.interlace) {
+        pass = 0;
+        return i;
+    }
+    static const uint8_t starts[4] = { 0, 4, 2, 1 };
+    static const uint8_t steps[4] = { 8, 8, 4, 2 };
+    for (pass = 0; pass < 3; pass++) {
+        uint16_t n_rows = ((uint32_t)h + steps[pass] - 1 - starts[pass]) / steps[pass];
+        if (i < n_rows) {
             break;
         }
+        i -= n_rows;
+    }
+    uint16_t y = starts[pass] + i * steps[pass];
+    pass++;
+    return y;
+}
 
-        // lzw decoding
-        if (code_table.contains(code)) {
-            indexes = code_table[code];
-            write_to_decoded_frame(indexes);
-            code_table[code_table.size()] = code_table[prev_code] + u8string(1, indexes[0]);
-            prev_code = code;
-        } else {
-            prev_indexes = code_table[prev_code];
-            new_indexes = prev_indexes + u8string(1, prev_indexes[0]);
-            write_to_decoded_frame(new_indexes);
-            code_table[code_table.size()] = new_indexes;
-            prev_code = code;
+// expand the i-th row of the frame in the lzw data onto the canvas, clipped to the canvas
+void GifDecoder::write_row(const uint8_t* indexes, uint16_t i, uint16_t n) {
+    uint8_t pass;
+    uint32_t canvas_y = this->image_desc.t + this->interlaced_row(i, pass);
+    if (canvas_y >= this->lsd.h || this->image_desc.l >= this->lsd.w) {
+        return;
+    }
+    n = min<uint32_t>(n, this->lsd.w - this->image_desc.l);
+    uint32_t l = this->image_desc.l;
+    uint8_t shift = this->scale_shift;
+    if (shift) {
+        // rows and columns off the sampling grid are dropped, the rest are packed for expansion
+        if (canvas_y & ((1 << shift) - 1)) {
+            return;
         }
-        if (code_table.size() == (1 << code_size)) {
-            code_size < 12 && code_size++; // some encoder will not emit clear code (and will not grow code size further)
+        uint32_t round = (1 << shift) - 1;
+        uint32_t out_l = (l + round) >> shift;
+        uint32_t out_r = (l + n + round) >> shift;
+        this->sampled_row.resize(this->get_width());
+        for (uint32_t x = out_l; x < out_r; x++) {
+            this->sampled_row[x - out_l] = indexes[(x << shift) - l];
         }
+        indexes = this->sampled_row.data();
+        n = out_r - out_l;
+        l = out_l;
+        canvas_y >>= shift;
+    }
+    uint8_t bpp = this->bytes_per_pixel();
+    unsigned char* dst;
+    if (this->canvas) {
+        dst = this->canvas + canvas_y * this->stride + (size_t)l * bpp;
+    } else if (this->row_sink) {
+        this->sink_row.assign((size_t)n * bpp, 0);
+        dst = this->sink_row.data();
+    } else {
+        return;
+    }
+    if (bpp == 4) {
+        expand_indexes_32(indexes, dst, n, this->palette, this->tran_index);
+    } else if (bpp == 3) {
+        expand_indexes_24(indexes, dst, n, this->palette, this->tran_index);
+    } else {
+        copy_indexes(indexes, dst, n, this->tran_index);
+    }
+    if (this->row_sink && n > 0) {
+        this->row_sink({ this->frame_cursor, (uint16_t)canvas_y, (uint16_t)l, n, pass, indexes, dst, this->tran_index });
     }
 }
@@ -1,22 +1,155 @@
+#ifndef GIF_DEC
+#define GIF_DEC
+
 #include "gif.h"
+#include "bytesource.h"
 #include <cassert>
-#include <fstream>
-#include <unordered_map>
+#include <functional>
+#include <span>
+#include <vector>
 
 using namespace std;
 
+// the bounding box of two rects, an empty rect is ignored
+rect_t union_rect(rect_t a, rect_t b);
+
 // write as argb for sdl rendering
+enum pix_fmt_t {
+    ARGB,
+    RGBA,
+    RGB,
+    INDEXED // one color index per pixel, see get_color_table()
+};
+
+// a row of a frame as it is drawn, in canvas coordinates
+typedef struct {
+    size_t frame;
+    uint16_t y;
+    uint16_t l; // the first pixel of the row covered by the frame
+    uint16_t n; // the number of pixels covered
+    uint8_t pass; // interlace pass from 1 to 4, 0 for frames that are not interlaced
+    const uint8_t* indexes; // color index of each pixel
+    // the pixels in pix_fmt, composited on the canvas when there is one
+    // without a canvas, transparent pixels are left zero
+    const unsigned char* pixels;
+    int tran_index; // -1 for none
+} gif_row_t;
+
+typedef std::function<void(const gif_row_t& row)> row_sink_t;
+
+// a frame located by scanning the file, without lzw decoding
+typedef struct {
+    size_t offset; // where decoding of the frame starts (its first extension block or image descriptor)
+    size_t image_offset; // offset of the image descriptor
+    size_t data_offset; // offset of the lzw-encoded image data (its min code size byte)
+    size_t end_offset; // offset right after the image data
+    gce_t gce;
+    image_desc_t image_desc;
+} frame_info_t;
+
+// what can be known about a gif without decoding its image data
 typedef struct {
-    uint16_t l;
-    uint16_t t;
     uint16_t w;
     uint16_t h;
-} rect_t;
+    size_t n_frames;
+    vector<uint16_t> delays; // gce delay of each frame, in 1/100 s
+    uint32_t duration; // sum of the delays, in 1/100 s
+    int loop_count; // netscape loop count, 0 for looping forever, -1 when there is no such extension (play once)
+} gif_probe_t;
 
-enum pix_fmt_t {
-    ARGB,
-    RGBA,
-    RGB
+// decoder state right after a frame is decoded, restored when seeking
+typedef struct {
+    size_t frame;
+    size_t next_offset;
+    string canvas;
+    // the frame's pending disposal
+    uint8_t disposal;
+    rect_t rect;
+    string restore;
+} keyframe_t;
+
+// what a frame changed on the canvas, replayed on top of the frame before it instead of decoding again
+typedef struct {
+    bool cached;
+    size_t next_offset;
+    rect_t dirty;
+    string pixels; // the canvas under dirty after the frame was drawn
+    uint16_t delay;
+    // the frame's pending disposal
+    uint8_t disposal;
+    rect_t rect;
+    string restore;
+    string color_table; // only kept for INDEXED output
+} cached_frame_t;
+
+typedef struct {
+    size_t hits; // frames served from the cache
+    size_t misses; // frames decoded while the cache was enabled
+    size_t frames; // frames held
+    size_t bytes; // memory held by the frames
+} frame_cache_stats_t;
+
+// gif limits the lzw code size to 12 bits
+#define LZW_MAX_CODES 4096
+
+// reads lzw codes from the image data sub-blocks as decoding proceeds
+// sub-blocks are consumed in place, and codes are taken from a 64-bit bit buffer
+class LzwCodeReader {
+    ByteSource& file;
+    const uint8_t* block{};
+    const uint8_t* block_end{};
+    bool end_of_blocks{};
+    bool is_truncated{};
+
+    uint64_t bits{};
+    uint8_t n_bits{};
+
+    void refill();
+public:
+    explicit LzwCodeReader(ByteSource& file);
+    // true when a code was read past the end of the sub-blocks (a stream without end code)
+    bool truncated() const {
+        return this->is_truncated;
+    }
+    uint16_t read(uint8_t code_size) {
+        if (this->n_bits < code_size) {
+            this->refill();
+        }
+        uint16_t code = this->bits & ((1 << code_size) - 1);
+        // a truncated stream yields the remaining bits padded with zeros
+        if (this->n_bits < code_size) {
+            this->is_truncated = true;
+            this->bits = 0;
+            this->n_bits = 0;
+            return code;
+        }
+        this->bits >>= code_size;
+        this->n_bits -= code_size;
+        return code;
+    }
+    // skip any sub-blocks left after the end code, including the block terminator
+    void finish();
+};
+
+// decodes the lzw image data of one frame into rows of color indexes
+// it only holds its own tables, so each thread can decode frames with its own instance
+class LzwDecoder {
+    // lzw dictionary, each code is a (prefix code, suffix index) pair
+    // the length of each code's expansion is kept so that it can be written backwards without a stack
+    uint16_t prefix[LZW_MAX_CODES];
+    uint8_t suffix[LZW_MAX_CODES];
+    uint16_t length[LZW_MAX_CODES];
+    // color indexes of the frame rows being decoded
+    vector<uint8_t> row_indexes;
+
+    void init_code_table(uint16_t size);
+    void expand_code(uint16_t code, uint8_t* dst);
+public:
+    // called with the indexes of row y (relative to the frame)
+    // n is the frame width, except for the last row of a truncated stream
+    typedef std::function<void(const uint8_t* indexes, uint16_t y, uint16_t n)> row_fn_t;
+    // decode from the lzw min code size byte to the block terminator of a w x h frame
+    void decode(ByteSource& file, uint16_t w, uint16_t h, const row_fn_t& on_row);
 };
 
 class GifDecoder {
@@ -29,10 +162,51 @@ class GifDecoder {
     string lct;
 
     uint32_t file_loop_offset{};
+    size_t frame_cursor{}; // the number of frames decoded since the start of the loop
+
+    // frame index and seeking
+    vector<frame_info_t> frame_index;
+    bool frame_index_built{};
+    size_t keyframe_interval{};
+    vector<keyframe_t> keyframes; // sorted by frame
+
+    // decoded frames kept for later loops, indexed by frame
+    vector<cached_frame_t> frame_cache;
+    size_t frame_cache_budget{}; // in bytes, 0 disables the cache
+    frame_cache_stats_t frame_cache_stats{};
+
+    // disposal of the last frame, applied right before the next frame is drawn
+    uint8_t prev_disposal{};
+    rect_t prev_rect{};
+    string prev_restore; // canvas under prev_rect before the last frame was drawn, for restore to previous
+    // the canvas area changed by the last decoded frame
+    rect_t dirty_rect{};
+    bool dirty_all{true}; // the whole canvas was reset since the last frame
+    uint16_t frame_delay{}; // gce delay of the last frame, in 1/100 s
+    int loop_count{-1};
 
     // storages
-    ifstream file;
-    unordered_map<uint16_t, u8string> code_table;
+    ByteSource file;
+    char buf[256]; // a temp buffer for file content
+    LzwDecoder lzw;
+    // the color table of the frame in output pixel format, and the transparent index (-1 for none)
+    uint32_t palette[256];
+    int tran_index{-1};
+    string frame_color_table; // rgb color table of the last frame, 256 entries
+    // where frames are composited, buffer unless the caller set its own canvas
+    unsigned char* canvas{};
+    size_t stride{}; // bytes from one canvas row to the next
+    // the caller-owned canvas from set_output(), nullptr for buffer
+    unsigned char* output_canvas{};
+    size_t output_stride{};
+    // the canvas is the gif canvas point sampled every (1 << scale_shift) pixels on both axes
+    uint8_t scale_shift{};
+    vector<uint8_t> sampled_row; // the indexes of a frame row that fall on sampled columns
+    // called for every row drawn, and whether frames are also composited on a canvas
+    row_sink_t row_sink;
+    bool use_canvas{true};
+    vector<unsigned char> sink_row; // expanded pixels of a row when there is no canvas
+    size_t buffer_size{}; // bytes allocated for buffer, enough for the pix_fmt it was last allocated for
 
     // configs
     pix_fmt_t pix_fmt;
@@ -43,17 +217,97 @@ class GifDecoder {
     void parse_gce();
     void parse_application_extension();
     void parse_comment_extension();
-    void lzw_unpack_decode();
-    void init_code_table(uint16_t size);
+    void skip_extension();
+    void init();
+    void alloc_canvas();
+    void init_palette();
+    uint16_t interlaced_row(uint16_t i, uint8_t& pass) const;
+    void write_row(const uint8_t* indexes, uint16_t i, uint16_t n);
     void decode_frame_internal();
+    uint8_t background() const;
+    rect_t scale_rect(rect_t rect) const;
+    rect_t canvas_rect() const;
+    rect_t frame_rect() const;
+    void fill_rect(rect_t rect);
+    void save_rect(rect_t rect, string& out) const;
+    void restore_rect(rect_t rect, const string& in);
+    void apply_disposal();
+    void begin_frame();
+    void finish_frame();
+    void composite_frame(const frame_info_t& info, const uint8_t* indexes, size_t n_indexes);
+    void save_keyframe();
+    void save_cached_frame();
+    bool replay_cached_frame();
+    void clear_frame_cache();
 
     string bytes_from_all_sub_blocks();
+    void skip_sub_blocks();
 public:
-    unsigned char* buffer;
-    GifDecoder(const char* filename, pix_fmt_t pix_fmt);
+    // the decoder's own canvas, allocated when the first frame is decoded
+    unsigned char* buffer{};
+    GifDecoder(const char* filename, pix_fmt_t pix_fmt, file_mode_t file_mode = FILE_READ);
+    // decode from bytes in memory without copying, the data must outlive the decoder
+    GifDecoder(std::span<const uint8_t> data, pix_fmt_t pix_fmt);
     ~GifDecoder();
     bool decode_frame();
+    // the canvas area changed by the last decode_frame(), including the area disposed from the frame before
+    // after construction, loop() or seeking, it covers the whole canvas
+    rect_t get_dirty_rect() const;
+    // the display time of the last decoded frame from its gce, in 1/100 s
+    uint16_t get_delay() const;
+    // the rgb color table (global or local) of the last decoded frame, 256 entries with missing ones black
+    // with INDEXED output, canvas pixels left from earlier frames refer to the tables of those frames
+    const string& get_color_table() const;
+    // the size of the canvas, which is the gif canvas size divided by the scale and rounded up
     uint16_t get_width() const;
     uint16_t get_height() const;
     void loop();
+    // from the netscape application extension, 0 for looping forever, -1 when absent
+    // only known once the extension is parsed, by decoding or scanning past it
+    int get_loop_count() const;
+
+    // composite frames straight into a caller-owned canvas of get_height() rows, stride bytes apart, in pix_fmt
+    // frames only update parts of the canvas, so its content must be left as is between decode_frame() calls
+    // the canvas is cleared and decoding restarts from the first frame, as with loop()
+    // nullptr goes back to buffer, with rows packed at the pixel size of pix_fmt
+    void set_output(unsigned char* canvas, size_t stride, pix_fmt_t pix_fmt);
+    // decode thumbnails on a canvas reduced by 1 << shift (up to 8) on both axes, sampling one pixel per block
+    // rects such as get_dirty_rect() are in the reduced canvas, a gif rect covers the canvas pixels sampled inside it
+    // like set_output(), the canvas is cleared and decoding restarts from the first frame
+    void set_scale(uint8_t shift);
+    // the smallest scale for which the canvas fits in max_w x max_h, or 1/8 if none does
+    void set_max_size(uint16_t max_w, uint16_t max_h);
+    // stream every row of each frame to sink as soon as lzw completes it, in the order of the lzw data
+    // without a canvas, frames are neither composited nor disposed, so memory stays bounded by a row
+    // keyframes and the frame cache need the canvas
+    // the frame cache is bypassed while a sink is set, so that every frame is decoded and reaches the sink
+    // turning the canvas off and on again keeps a canvas set with set_output()
+    void set_row_sink(row_sink_t sink, bool with_canvas = true);
+    unsigned char* get_canvas() const; // nullptr until the first frame is decoded, or without a canvas
+    size_t get_stride() const;
+    // the size of a canvas pixel in pix_fmt
+    uint8_t bytes_per_pixel() const;
+
+    // locate every frame with its gce and image descriptor, skipping image data without lzw decoding
+    const vector<frame_info_t>& scan_frames();
+    // canvas size, frame count, delays and loop count from scan_frames(), without lzw decoding or a canvas
+    gif_probe_t probe();
+    // snapshot the canvas every n frames while decoding, 0 disables snapshots
+    void set_keyframe_interval(size_t n);
+    // make the canvas hold the composited frame n (0-based), so that the next decode_frame() yields frame n + 1
+    // decoding resumes from the closest keyframe at or before n, or from the current frame when that is closer
+    void seek_to_frame(size_t n);
+    // the number of frames decoded since the start of the loop
+    size_t get_frame_cursor() const;
+
+    // keep what each decoded frame changed, up to budget bytes, so that later loops replay frames from memory
+    // frames past the budget are decoded again, 0 disables the cache and frees it
+    void set_frame_cache(size_t budget);
+    frame_cache_stats_t get_frame_cache_stats() const;
+
+    // decode all remaining frames, running lzw for several frames at once on n threads (0 for one per hardware thread)
+    // frames are composited in order on the calling thread, and on_frame(n) is called while the canvas holds frame n
+    void decode_frames_parallel(size_t n_threads, const std::function<void(size_t frame)>& on_frame);
 };
+
+#endif
@@ -1,52 +1,31 @@
-#include "gif.h"
+#include "gifenc.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
-#include <map>
 #include <fstream>
 #include <iostream>
+#include <unistd.h>
 
 using namespace std;
 
-template<typename T>
-inline T i_ceil_div(T x, T y) {
-    return x/y+(x%y != 0);
-}
-
-// integer ceil division operation
-//#define i_ceil_div(x, y) (x/y + (x % y != 0))
-// output any expression as string auto formatted
-#define c_out(x) cout << x
-// output any expression as a char (may emit invisible character)
-#define c_out_raw(x) cout << (unsigned char)x
-#define c_out_raw2(x, y) cout << (unsigned char)x << (unsigned char)y
-#define c_out_raw3(x, y, z) cout << (unsigned char)x << (unsigned char)y << (unsigned char)z
-// output an u16 number in 2 bytes, little-endian
-#define c_out_u16_le(x) \
-    uint8_t a = x & 0xff; \
-    uint8_t b = (x >> 8) & 0xff; \
-    c_out_raw2(a, b)
-typedef vector<pair<uint16_t, uint8_t>> lzw_compressed_t;
-
-void debug_lzw(lzw_compressed_t vec) {
-    cout << endl;
-    cout << "debugging lzw" << endl;
-    for (size_t i = 0; i < 5; i++) {
-        cout << i << " " << vec[i].first << " " << static_cast<char8_t >(vec[i].second) << endl;
-    }
-    for (size_t i = vec.size() - 5; i < vec.size(); i++) {
-        cout << i << " " << vec[i].first << " " << static_cast<char8_t >(vec[i].second) << endl;
-    }
-}
+// output any expression as a byte to the encoder's sink
+#define c_out_raw(x) this->out.put((uint8_t)(x))
+#define c_out_raw2(x, y) do { c_out_raw(x); c_out_raw(y); } while (0)
+#define c_out_raw3(x, y, z) do { c_out_raw(x); c_out_raw(y); c_out_raw(z); } while (0)
 
 template<typename T>
 void debug_print_vec(vector<T> vec) {
     cout << endl;
     cout << "debugging vec" << endl;
     for (size_t i = 0; i < 5; i++) {
-        cout << i << " " << static_cast<char8_t >(vec[i]) << endl;
+        cout << i << " " << static_cast<int>(vec[i]) << endl;
     }
     for (size_t i = vec.size() - 5; i < vec.size(); i++) {
-        cout << i << " " << static_cast<char8_t >(vec[i]) << endl;
+        cout << i << " " << static_cast<int>(vec[i]) << endl;
     }
 }
 
@@ -79,249 +58,374 @@ void read_ppm2(char *filename, ppm_t *ppm) {
     ppm->header = header;
 }
 
-static CodeTable<u16string, uint16_t> code_table;
+GifEncoder::GifEncoder(uint16_t _w, uint16_t _h, ByteSink& _out, palette_mode_t _palette_mode):
+    w(_w), h(_h), out(_out), palette_mode(_palette_mode) {}
+
+void GifEncoder::set_threads(size_t n) {
+    this->n_threads = n;
+}
+
+void GifEncoder::set_transparency(bool enabled) {
+    this->transparency = enabled;
+}
+
+void GifEncoder::set_max_rects(size_t n) {
+    assert(n > 0 && "a frame needs at least one rect");
+    this->max_rects = n;
+}
+
+void LzwEncoder::init_code_table(uint8_t min_code_size) {
+    // root codes are implicit, followed by clear code and end code
+    memset(this->code_keys, 0, sizeof(this->code_keys));
+    this->next_code = (1 << min_code_size) + 2;
+}
+
+// the slot holding (prefix, index), or the empty slot where it belongs
+uint16_t LzwEncoder::find_code_slot(uint16_t prefix, uint8_t index) const {
+    uint32_t key = ((uint32_t)prefix << 8 | index) + 1;
+    uint16_t slot = (key * 2654435761u) >> 19; // multiplicative hash into 13 bits
+    while (this->code_keys[slot] && this->code_keys[slot] != key) {
+        slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+    }
+    return slot;
+}
+
+void GifEncoder::init_color_mapping() {
+    /* a 252 colored (close-to 256) palette, 7 levels of blue (step 42) x 6 of green x 6 of red (step 51) */
+    // index = b / 42 * 36 + g / 51 * 6 + r / 51, summed from one table per channel
+    for (size_t v = 0; v < 256; v++) {
+        this->r_index[v] = v / 51;
+        this->g_index[v] = v / 51 * 6;
+        this->b_index[v] = v / 42 * 36;
+    }
+}
 
-void init_code_table() {
-    code_table.clear();
-    for (size_t i = 0; i < 256; i++) {
-        u16string c;
-        c.push_back(i);
-        code_table.insert(c);
+// the palette of all frames from a histogram of about a million of their pixels
+void GifEncoder::init_adaptive_palette(const vector<string>& frames) {
+    vector<uint32_t> histogram(RGB15_COLORS);
+    size_t n_pixels = (size_t)this->w * this->h;
+    size_t step = max<size_t>(1, n_pixels * frames.size() >> 20);
+    for (const string& frame: frames) {
+        add_to_histogram((const uint8_t*)frame.data(), n_pixels, step, histogram.data());
     }
+    build_palette(histogram.data(), this->transparency ? 255 : 256, this->palette);
 }
 
-static map<uint32_t, uint8_t> color_mapping;
+// the number of bits to index a color table of n colors, at least 1
+static uint8_t table_bits(uint16_t n) {
+    uint8_t bits = 1;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    return bits;
+}
 
-void init_color_mapping() {
-    /* generate a 252 colored (close-to 256) color_mapping */
-    uint8_t i = 0;
+SubBlockWriter::SubBlockWriter(ByteSink& _out): out(_out) {}
 
-    for (size_t b = 0; b < 256; b += 42) {
-        for (size_t g = 0; g < 256; g += 51) {
-            for (size_t r = 0; r < 256; r += 51) {
-                uint32_t rgb = (b << 16) | (g << 8) | r;
-                color_mapping[rgb] = i;
-                i++;
-            }
-        }
+void SubBlockWriter::flush_block() {
+    this->block[0] = this->block_size;
+    this->out.write(this->block, this->block_size + 1);
+    this->block_size = 0;
+}
+
+void SubBlockWriter::finish() {
+    if (this->n_bits > 0) {
+        this->block[1 + this->block_size++] = this->bits & 0xff;
+        this->bits = 0;
+        this->n_bits = 0;
+    }
+    if (this->block_size > 0) {
+        this->flush_block();
     }
+    this->out.put(0x00); // end of block
 }
 
 // todo boxes_1.ppm
-lzw_compressed_t lzw_encode(
-        const string& color_indexes,
-        uint16_t w, uint16_t h,
-        uint16_t dl, uint16_t dt, uint16_t dw, uint16_t dh
+void LzwEncoder::encode(
+        const uint8_t* indexes, uint16_t w,
+        uint16_t dl, uint16_t dt, uint16_t dw, uint16_t dh,
+        uint8_t min_code_size, const uint8_t* remap,
+        SubBlockWriter& writer
     ) {
-    string rect;
-    for (uint16_t i = 0; i < dh; i++) {
-        for (uint16_t j = 0; j < dw; j++) {
-            size_t idx = (dt + i) * w + dl + j;
-            rect.push_back(color_indexes[idx]);
-        }
-    }
-    vector<pair<uint16_t, uint8_t>> output;
-    uint8_t min_code_size = 8;
     uint16_t clear_code = 1 << min_code_size;
     uint16_t end_code = clear_code + 1;
-    u16string clear_codestr;
-    clear_codestr.push_back(clear_code);
-    u16string end_codestr;
-    end_codestr.push_back(end_code);
-    init_code_table();
-    code_table.insert(clear_codestr);
-    code_table.insert(end_codestr);
-
-    u16string prev;
+    this->init_code_table(min_code_size);
+
     uint8_t code_size = min_code_size + 1;
 
-    output.emplace_back(clear_code, code_size);
-    uint8_t first = rect[0];
-    prev.push_back(first);
-
-    for (size_t i = 1; i < rect.size(); i++) {
-        uint8_t next = rect[i];
-        // add clear code and reset color table here
-        if (code_table.size() == 4096) { // MAX_SIZE
-            init_code_table();
-            code_table.insert(clear_codestr);
-            code_table.insert(end_codestr);
-            output.emplace_back(clear_code, code_size);
-            code_size = min_code_size + 1;
-        }
+    writer.write(clear_code, code_size);
+    // the rect is read in place, row by row
+    const uint8_t* rect = indexes + (size_t)dt * w + dl;
+    // the code of the longest string in the table matching the input so far
+    uint16_t prev = remap[rect[0]];
+
+    for (uint16_t y = 0; y < dh; y++) {
+        const uint8_t* row = rect + (size_t)y * w;
+        for (uint16_t x = y == 0 ? 1 : 0; x < dw; x++) {
+            uint8_t next = remap[row[x]];
+            // add clear code and reset color table here
+            if (this->next_code == 4096) { // MAX_SIZE
+                this->init_code_table(min_code_size);
+                writer.write(clear_code, code_size);
+                code_size = min_code_size + 1;
+            }
 
-        u16string next_str;
-        next_str.push_back(next);
-        u16string comb = prev + next_str;
-        if (code_table.has(comb)) {
-            prev.push_back(next);
-        } else {
-            uint16_t code = code_table.get(prev);
-            output.emplace_back(code, code_size);
-            // raise the code_size here
-            if (code_table.size() == 1 << code_size) {
-                code_size++;
+            uint16_t slot = this->find_code_slot(prev, next);
+            if (this->code_keys[slot]) {
+                prev = this->code_values[slot];
+            } else {
+                writer.write(prev, code_size);
+                // raise the code_size here
+                if (this->next_code == 1 << code_size) {
+                    code_size++;
+                }
+                // add new_code intro color map
+                this->code_keys[slot] = ((uint32_t)prev << 8 | next) + 1;
+                this->code_values[slot] = this->next_code++;
+                prev = next;
             }
-            // add new_code intro color map
-            code_table.insert(comb);
-            prev = next_str;
         }
     }
-    if (!prev.empty()) {
-        uint16_t code = code_table.get(prev);
-        output.emplace_back(code, code_size);
-    }
-    output.emplace_back(end_code, code_size);
-    return output;
+    writer.write(prev, code_size);
+    writer.write(end_code, code_size);
+    writer.finish();
 }
 
-vector<uint8_t> lzw_pack(const lzw_compressed_t& codes) {
-    vector<uint8_t> output;
-    uint32_t n_bit = 0;
-    for (auto item: codes) {
-        auto [code, code_size] = item;
-        // the bit position - amount to shift left
-        uint16_t shl = n_bit % 8;
-        // the index position of bytestream where the byte output is emitted
-        uint16_t index = n_bit / 8;
-        if (index >= output.size()) output.push_back(0);
-        // fill in the bits of code onto the right position
-        output[index] |= (code << shl);
-        // ensure that the result is not greater than a byte
-        output[index] &= 0xff;
-        // if there is any bits that go past the next byte
-        bool pass_next_byte = shl + code_size > 8;
-        if (pass_next_byte) {
-            // output remaining bits onto next byte
-            uint8_t remain_bits = code >> (8 - shl);
-            if (index + 1 >= output.size()) {
-                output.push_back(0);
+// the changed pixels of a row span [first, end), false when the row is unchanged
+static bool diff_row(const uint8_t* a, const uint8_t* b, size_t n, size_t& first, size_t& end) {
+    // most rows of a screen recording do not change, and memcmp skips them with wide compares
+    if (!memcmp(a, b, n)) {
+        return false;
+    }
+    // 8 pixels at a time from both ends, where the low byte of a little endian word is the leftmost pixel
+    uint64_t x, y;
+    for (first = 0;; first += 8) {
+        if (first + 8 > n) {
+            while (a[first] == b[first]) {
+                first++;
+            }
+            break;
+        }
+        memcpy(&x, a + first, 8);
+        memcpy(&y, b + first, 8);
+        if (x != y) {
+            first += __builtin_ctzll(x ^ y) / 8;
+            break;
+        }
+    }
+    for (end = n;; end -= 8) {
+        if (end < first + 8) {
+            while (a[end - 1] == b[end - 1]) {
+                end--;
             }
-            output[index + 1] |= remain_bits;
+            break;
         }
-        // if there is any bits that go past the next-next byte
-        bool pass_next_next_byte = shl + code_size > 16;
-        if (pass_next_next_byte) {
-            // output remaining bits onto next byte
-            uint8_t remain_bits = code >> (16 - shl);
-            if (index + 2 >= output.size()) output.push_back(0);
-            output[index + 2] |= remain_bits;
+        memcpy(&x, a + end - 8, 8);
+        memcpy(&y, b + end - 8, 8);
+        if (x != y) {
+            end -= __builtin_clzll(x ^ y) / 8;
+            break;
         }
-        n_bit += code_size;
     }
-    return output;
+    return true;
 }
 
-template<typename T>
-vector<vector<T>> make_chunk(const vector<T>& arr, size_t chunk_size) {
-    vector<vector<T>> chunks;
-    size_t num_of_chunks = i_ceil_div(arr.size(), chunk_size);
-    for (size_t i = 0; i < num_of_chunks; i++) {
-        vector<T> chunk;
-        for (size_t j = 0; j < chunk_size; j++) {
-            size_t idx = i * chunk_size + j;
-            if (idx < arr.size()) {
-                T item = arr[i * chunk_size + j];
-                chunk.push_back(item);
+vector<rect_t> get_diff_rects(const string& frame, const string& last_frame, uint16_t width, uint16_t height, size_t max_rects) {
+    vector<rect_t> rects;
+    size_t gap = 0; // unchanged rows since the last changed one
+    for (uint16_t y = 0; y < height; y++) {
+        size_t offset = (size_t)y * width;
+        size_t first, end;
+        if (!diff_row((const uint8_t*)frame.data() + offset, (const uint8_t*)last_frame.data() + offset, width, first, end)) {
+            gap++;
+            continue;
+        }
+        if (!rects.empty()) {
+            // extend the last rect over the gap, unless the gap is worth a rect of its own
+            rect_t& rect = rects.back();
+            size_t l = min<size_t>(rect.l, first);
+            size_t r = max<size_t>(rect.l + rect.w, end);
+            if (rects.size() >= max_rects || gap * (r - l) < DIFF_SPLIT_AREA) {
+                rect.l = l;
+                rect.w = r - l;
+                rect.h = y + 1 - rect.t;
+                gap = 0;
+                continue;
             }
         }
-        chunks.push_back(chunk);
+        rects.push_back(rect_t{ (uint16_t)first, y, (uint16_t)(end - first), 1 });
+        gap = 0;
+    }
+    if (rects.empty()) {
+        // an unchanged frame still needs an image to take its delay
+        rects.push_back(rect_t{ 0, 0, 1, 1 });
     }
-    return chunks;
+    return rects;
 }
 
-string last_color_indexes;
-
-tuple<uint16_t, uint16_t, uint16_t, uint16_t> get_diff_rect(const string& frame, const string& last_frame, uint16_t width, uint16_t height) {
-    uint16_t d_left = width - 1;
-    uint16_t d_top = height - 1;
-    uint16_t d_right = 0;
-    uint16_t d_bottom = 0;
-    for (uint16_t top = 0; top < height; top++) {
-        for (uint16_t left = 0; left < width; left++) {
-            uint16_t idx = top * width + left;
-            bool same = frame[idx] == last_frame[idx];
-            if (!same) {
-                d_left = min(d_left, left);
-                d_top = min(d_top, top);
-                d_right = max(d_right, left);
-                d_bottom = max(d_bottom, top);
-            }
+string GifEncoder::quantize_frame(const string& frame) const {
+    string color_indexes((size_t)this->w * this->h, ' ');
+    const uint8_t* rgb = (const uint8_t*)frame.data();
+    uint8_t* indexes = (uint8_t*)color_indexes.data();
+    size_t n = frame.size() / 3;
+    if (this->palette_mode == PALETTE_ADAPTIVE) {
+        map_to_palette(rgb, n, this->palette, indexes);
+    } else {
+        for (size_t i = 0; i < n; i++, rgb += 3) {
+            indexes[i] = this->r_index[rgb[0]] + this->g_index[rgb[1]] + this->b_index[rgb[2]];
         }
     }
-    return tuple {d_left, d_top, d_right - d_left + 1, d_bottom - d_top + 1 };
+    return color_indexes;
 }
 
-void encode_frame(const string& frame, uint16_t w, uint16_t h) {
-    string color_indexes(w * h, ' ');
-    for (size_t i = 0; i < frame.size(); i += 3) {
-        uint8_t r = frame[i + 0];
-        uint8_t g = frame[i + 1];
-        uint8_t b = frame[i + 2];
-
-        r -= r % 51;
-        g -= g % 51;
-        b -= b % 42;
-        uint32_t rgb = (b << 16) | (g << 8) | r;
-        uint8_t idx = color_mapping[rgb];
-        color_indexes[i / 3] = (char)idx;
+string GifEncoder::encode_frame(const string& color_indexes, const string* last_color_indexes, rect_t rect, uint16_t delay) const {
+    uint16_t w = this->w;
+    uint16_t d_left = rect.l;
+    uint16_t d_top = rect.t;
+    uint16_t d_width = rect.w;
+    uint16_t d_height = rect.h;
+    // the rect is encoded in place, unless pixels left from the last frame are masked as transparent
+    const uint8_t* indexes = (const uint8_t*)color_indexes.data() + (size_t)d_top * w + d_left;
+    uint16_t stride = w;
+    string masked;
+    if (last_color_indexes) {
+        masked = string((size_t)d_width * d_height, ' ');
+        const uint8_t* last = (const uint8_t*)last_color_indexes->data() + (size_t)d_top * w + d_left;
+        for (uint16_t y = 0; y < d_height; y++) {
+            const uint8_t* row = indexes + (size_t)y * w;
+            const uint8_t* last_row = last + (size_t)y * w;
+            uint8_t* masked_row = (uint8_t*)masked.data() + (size_t)y * d_width;
+            for (uint16_t x = 0; x < d_width; x++) {
+                masked_row[x] = row[x] == last_row[x] ? this->tran_index : row[x];
+            }
+        }
+        indexes = (const uint8_t*)masked.data();
+        stride = d_width;
+    }
+    string bytes;
+    ByteSink out(bytes, 1 << 12);
+
+    // the colors used in the rect decide the smallest color table and lzw code size for the frame
+    bool used[256] = {};
+    for (uint16_t y = 0; y < d_height; y++) {
+        const uint8_t* row = indexes + (size_t)y * stride;
+        for (uint16_t x = 0; x < d_width; x++) {
+            used[row[x]] = true;
+        }
+    }
+    uint16_t n_used = 0;
+    uint16_t max_used = 0;
+    for (uint16_t i = 0; i < 256; i++) {
+        if (used[i]) {
+            n_used++;
+            max_used = i;
+        }
+    }
+    uint8_t global_bits = table_bits(max_used + 1);
+    uint8_t local_bits = table_bits(n_used);
+    // a local table of just those colors pays off when the shorter codes save more than the table costs
+    // lzw emits about a code per few pixels, taken as 4 here
+    size_t saved_bytes = (size_t)d_width * d_height / 4 * (max<uint8_t>(global_bits, 2) - max<uint8_t>(local_bits, 2)) / 8;
+    bool use_lct = local_bits < global_bits && saved_bytes > (3u << local_bits);
+
+    uint8_t remap[256];
+    string lct;
+    for (uint16_t i = 0; i < 256; i++) {
+        remap[i] = i;
+    }
+    if (use_lct) {
+        uint8_t rgb[3];
+        for (uint16_t i = 0; i < 256; i++) {
+            if (used[i]) {
+                remap[i] = lct.size() / 3;
+                this->global_color(i, rgb);
+                lct.append((const char*)rgb, 3);
+            }
+        }
+        lct.resize(3 << local_bits, 0);
     }
-    auto [ d_left, d_top, d_width, d_height ] = get_diff_rect(color_indexes, last_color_indexes, w, h);
     // gce
-    gce_t gce;
-    gce.packed.disposal = 0;
+    gce_t gce{};
     gce.packed.user_input = 0;
-    gce.packed.transparent = 0;
-    gce.delay = 50; // speed 50 * 1/100 = 0.5s
-    gce.tran_index = 0;
-    c_out_raw3(0x21, 0xf9, 0x04); // block label
-    for (uint8_t i : gce.raw) {
-        c_out_raw(i);
+    gce.delay = delay;
+    if (last_color_indexes) {
+        // keep the last frame under the transparent pixels
+        gce.packed.disposal = 1;
+        gce.packed.transparent = 1;
+        gce.tran_index = remap[this->tran_index];
+    } else {
+        gce.packed.disposal = 0;
+        gce.packed.transparent = 0;
+        gce.tran_index = 0;
     }
-    c_out_raw(0x00); // block terminator
+    out.write("\x21\xf9\x04", 3); // block label
+    out.write(gce.raw, sizeof(gce.raw));
+    out.put(0x00); // block terminator
     // image_desc
-    image_desc_t image_desc;
+    image_desc_t image_desc{};
     image_desc.w = d_width;
     image_desc.h = d_height;
     image_desc.l = d_left;
     image_desc.t = d_top;
-    image_desc.packed.has_lct = 0;
     image_desc.packed.interlace = 0;
-    image_desc.packed.lct_sz = 0;
     image_desc.packed.sort = 0;
-    c_out_raw(0x2c); // block label;
-    for (uint8_t i : image_desc.raw) {
-        c_out_raw(i);
-    }
+    image_desc.packed.has_lct = use_lct;
+    image_desc.packed.lct_sz = use_lct ? local_bits - 1 : 0;
+    out.put(0x2c); // block label;
+    out.write(image_desc.raw, sizeof(image_desc.raw));
+    out.write(lct);
     // lzw_image_data_block
-    c_out_raw(0x08); // lzw min code size
-    lzw_compressed_t lzw_compressed = lzw_encode(color_indexes, w, h, image_desc.l, image_desc.t, image_desc.w, image_desc.h);
-#ifdef DEBUG
-    debug_lzw(lzw_compressed);
-#endif
-    vector<uint8_t> packed = lzw_pack(lzw_compressed);
-#ifdef DEBUG
-    debug_print_vec(packed);
-#endif
-    vector<vector<uint8_t>> chunks = make_chunk(packed, 255);
-    for (const vector<uint8_t>& chunk: chunks) {
-        c_out_raw(chunk.size());
-        for (uint8_t elem: chunk) {
-            c_out_raw(elem);
+    uint8_t min_code_size = max<uint8_t>(use_lct ? local_bits : global_bits, 2);
+    out.put(min_code_size);
+    SubBlockWriter writer(out);
+    LzwEncoder lzw;
+    lzw.encode(indexes, stride, 0, 0, d_width, d_height, min_code_size, remap, writer);
+    out.flush();
+    return bytes;
+}
+
+// the rgb color of an index of the global color table, unused entries are black
+void GifEncoder::global_color(uint8_t index, uint8_t* rgb) const {
+    if (this->palette_mode == PALETTE_ADAPTIVE) {
+        if (index < this->palette.n_colors) {
+            memcpy(rgb, this->palette.colors + index * 3, 3);
+        } else {
+            memset(rgb, 0, 3);
         }
+    } else if (index < 252) {
+        rgb[0] = index % 6 * 51;
+        rgb[1] = index / 6 % 6 * 51;
+        rgb[2] = index / 36 * 42;
+    } else {
+        memset(rgb, 0, 3); // 4 blacks for padding
     }
-    c_out_raw(0x00); // end of block
-    last_color_indexes = color_indexes;
 }
 
-void gif_encode(const vector<string>& frames, uint16_t w, uint16_t h) {
-    // init_last_frame_color_index
-    last_color_indexes = string(w * h,  ' ');
-    init_color_mapping();
+// 256 colors, padded with black
+void GifEncoder::output_gct() {
+    uint8_t rgb[3];
+    for (uint16_t i = 0; i < 256; i++) {
+        this->global_color(i, rgb);
+        this->out.write(rgb, 3);
+    }
+}
+
+void GifEncoder::encode(const vector<string>& frames) {
+    uint16_t w = this->w;
+    uint16_t h = this->h;
+    if (this->palette_mode == PALETTE_ADAPTIVE) {
+        // the last index is left out of the palette for transparency
+        this->tran_index = 255;
+        this->init_adaptive_palette(frames);
+    } else {
+        // an index past the 252 colors of the cube
+        this->tran_index = 252;
+        this->init_color_mapping();
+    }
     // header
-    c_out("GIF89a");
+    this->out.write("GIF89a", 6);
     // lsd
-    lsd_t lsd;
+    lsd_t lsd{};
     lsd.w = w;
     lsd.h = h;
     lsd.packed.has_gct = 1;
@@ -330,73 +434,68 @@ void gif_encode(const vector<string>& frames, uint16_t w, uint16_t h) {
     lsd.packed.gct_sz = 7;
     lsd.bci = 0;
     lsd.par = 0;
-    for (uint8_t i : lsd.raw) {
-        c_out_raw(i);
-    }
-    // gct
-    for (auto kv: color_mapping) {
-        uint32_t color = kv.first;
-        uint8_t b = (color & 0xff0000) >> 16;
-        uint8_t g = (color & 0x00ff00) >> 8;
-        uint8_t r = (color & 0x0000ff);
-        c_out_raw3(r, g, b);
-    }
-    // 4 blacks for padding
-    c_out_raw3(0, 0, 0);
-    c_out_raw3(0, 0, 0);
-    c_out_raw3(0, 0, 0);
-    c_out_raw3(0, 0, 0);
+    this->out.write(lsd.raw, sizeof(lsd.raw));
+    this->output_gct();
     // Netscape Looping Application Extension
     c_out_raw3(0x21, 0xff, 0x0b);
-    c_out("NETSCAPE2.0");
+    this->out.write("NETSCAPE2.0", 11);
     c_out_raw2(0x03, 0x01);
-    c_out_u16_le(0); // infinite loop
+    this->out.write_u16_le(0); // infinite loop
     c_out_raw(0x00);
 
-    // encode frame
-    for (const string& frame: frames) {
-        encode_frame(frame, w, h);
+    // frames are quantized ahead on the pool, diffed in order against the frame before,
+    // then lzw encoded on the pool and written out in order
+    // both stages run ahead of the output by a bounded window of frames
+    ThreadPool pool(this->n_threads);
+    size_t window = pool.size() * 2;
+    std::deque<std::future<string>> quantized;
+    std::deque<std::future<string>> encoded;
+    size_t next = 0;
+    shared_ptr<const string> last_color_indexes;
+    for (size_t i = 0; i < frames.size(); i++) {
+        while (next < frames.size() && next < i + window) {
+            const string& frame = frames[next++];
+            quantized.push_back(pool.submit([this, &frame]() { return this->quantize_frame(frame); }));
+        }
+        auto color_indexes = make_shared<const string>(quantized.front().get());
+        quantized.pop_front();
+        // the first frame covers the whole canvas
+        vector<rect_t> rects = { rect_t{ 0, 0, w, h } };
+        if (last_color_indexes) {
+            rects = get_diff_rects(*color_indexes, *last_color_indexes, w, h, this->max_rects);
+        }
+        shared_ptr<const string> masked_by = this->transparency ? last_color_indexes : nullptr;
+        encoded.push_back(pool.submit([=, this]() {
+            // the rects of a frame are shown at once, the frame's delay goes on the last
+            string bytes;
+            for (size_t j = 0; j < rects.size(); j++) {
+                bytes += this->encode_frame(*color_indexes, masked_by.get(), rects[j], j + 1 == rects.size() ? 50 : 0); // speed 50 * 1/100 = 0.5s
+            }
+            return bytes;
+        }));
+        last_color_indexes = color_indexes;
+        if (encoded.size() == window) {
+            this->out.write(encoded.front().get());
+            encoded.pop_front();
+        }
+    }
+    for (; !encoded.empty(); encoded.pop_front()) {
+        this->out.write(encoded.front().get());
     }
 
     c_out_raw(0x3b); // end of gif
+    this->out.flush();
 }
 
-typedef struct {
-    char r;
-    char g;
-    char b;
-} rgb_t;
-
-string get_frame(uint16_t width, uint16_t height, size_t t, rgb_t (*fn)(uint16_t left, uint16_t top, uint16_t width, uint16_t height, size_t t)) {
-    string output_frame;
-    for (uint16_t top = 0; top < height; top++) {
-        for (uint16_t left = 0; left < width; left++) {
-            rgb_t rgb = fn(left, top, width, height, t);
-            output_frame += rgb.r;
-            output_frame += rgb.g;
-            output_frame += rgb.b;
-        }
-    }
-    return output_frame;
+void gif_encode(const vector<string>& frames, uint16_t w, uint16_t h, ByteSink& out, palette_mode_t palette_mode, size_t n_threads, bool transparency) {
+    GifEncoder encoder(w, h, out, palette_mode);
+    encoder.set_threads(n_threads);
+    encoder.set_transparency(transparency);
+    encoder.encode(frames);
 }
 
-int main() {
-    uint16_t W = 32;
-    uint16_t H = 32;
-    auto shader = [](uint16_t left, uint16_t top, uint16_t width, uint16_t height, size_t t) -> rgb_t {
-        char r = (char)((float)left / (float)width * 255.0);
-        char g = (char)((float)top / (float)height * 255.0);
-        char b = (char)t;
-        return rgb_t { r, g, b };
-    };
-
-    // todo infinite loop when t = 0,1,2
-    vector<string> frames = {
-        get_frame(W, H, 0, shader),
-        get_frame(W, H, 127, shader),
-        get_frame(W, H, 255, shader)
-    };
-
-    gif_encode(frames, W, H);
-    return 0;
+int gif_encode(const vector<string>& frames, uint16_t w, uint16_t h, palette_mode_t palette_mode, size_t n_threads, bool transparency) {
+    ByteSink out(STDOUT_FILENO);
+    gif_encode(frames, w, h, out, palette_mode, n_threads, transparency);
+    return out.get_error();
 }
@@ -0,0 +1,120 @@
+#ifndef GIF_ENC
+#define GIF_ENC
+
+#include "gif.h"
+#include "bytesink.h"
+#include "quantize.h"
+#include <string>
+#include <vector>
+
+// slots of the lzw dictionary hash, twice the number of codes to keep probe sequences short
+#define LZW_HASH_SIZE 8192
+
+// a run of unchanged rows between two changed ones splits the dirty rect when it covers this many pixels
+// below that, encoding the run costs less than the gce and image descriptor of another rect
+#define DIFF_SPLIT_AREA 1024
+
+// the parts of frame that differ from last_frame (w * h color indexes each), as bands of rows
+// each band is bounded by its changed columns, and there are at most max_rects bands
+// identical frames give a 1x1 rect
+std::vector<rect_t> get_diff_rects(const std::string& frame, const std::string& last_frame, uint16_t w, uint16_t h, size_t max_rects);
+
+// packs lzw codes lsb first into data sub-blocks of up to 255 bytes, written out as each block fills
+class SubBlockWriter {
+    ByteSink& out;
+    uint64_t bits{};
+    uint8_t n_bits{};
+    uint8_t block[256]; // the length byte followed by up to 255 data bytes
+    uint16_t block_size{};
+
+    void flush_block();
+public:
+    explicit SubBlockWriter(ByteSink& out);
+    void write(uint16_t code, uint8_t code_size) {
+        this->bits |= (uint64_t)code << this->n_bits;
+        this->n_bits += code_size;
+        while (this->n_bits >= 8) {
+            this->block[1 + this->block_size++] = this->bits & 0xff;
+            this->bits >>= 8;
+            this->n_bits -= 8;
+            if (this->block_size == 255) {
+                this->flush_block();
+            }
+        }
+    }
+    // write the last partial byte, the last sub-block and the block terminator
+    void finish();
+};
+
+// lzw encodes color index rects into sub-blocks
+// it only holds its own dictionary, so each thread can encode frames with its own instance
+class LzwEncoder {
+    // an open addressing hash from (prefix code, next index) to code
+    uint32_t code_keys[LZW_HASH_SIZE]; // prefix code << 8 | next index, plus 1 so that 0 marks an empty slot
+    uint16_t code_values[LZW_HASH_SIZE];
+    uint16_t next_code;
+
+    void init_code_table(uint8_t min_code_size);
+    uint16_t find_code_slot(uint16_t prefix, uint8_t index) const;
+public:
+    // encode the dw x dh rect at (dl, dt) of a plane of indexes w wide, mapping each index through remap
+    void encode(
+        const uint8_t* indexes, uint16_t w,
+        uint16_t dl, uint16_t dt, uint16_t dw, uint16_t dh,
+        uint8_t min_code_size, const uint8_t* remap,
+        SubBlockWriter& writer
+    );
+};
+
+enum palette_mode_t {
+    PALETTE_FIXED, // a 252 color cube
+    PALETTE_ADAPTIVE // median cut over the colors of all frames
+};
+
+// encodes rgb frames of a fixed size into an animated gif written to a sink
+// all encoding state belongs to the instance, so encoders on different threads do not interfere
+class GifEncoder {
+    uint16_t w;
+    uint16_t h;
+    ByteSink& out;
+    size_t n_threads{};
+    bool transparency{};
+    size_t max_rects{1};
+    uint8_t tran_index{}; // the global index reserved for transparency, outside the palette colors
+
+    // per channel parts of the fixed palette index, see init_color_mapping()
+    uint8_t r_index[256];
+    uint8_t g_index[256];
+    uint8_t b_index[256];
+    palette_mode_t palette_mode;
+    adaptive_palette_t palette;
+
+    void init_color_mapping();
+    void init_adaptive_palette(const std::vector<std::string>& frames);
+    void global_color(uint8_t index, uint8_t* rgb) const;
+    void output_gct();
+    std::string quantize_frame(const std::string& frame) const;
+    // the gce, image descriptor, color table and image data of a rect of a frame
+    // pixels of the rect equal in last_color_indexes are written as transparent, unless it is nullptr
+    std::string encode_frame(const std::string& color_indexes, const std::string* last_color_indexes, rect_t rect, uint16_t delay) const;
+public:
+    GifEncoder(uint16_t w, uint16_t h, ByteSink& out, palette_mode_t palette_mode = PALETTE_FIXED);
+    // quantize and lzw encode frames on n threads (0 for one per hardware thread)
+    // only the diff rects depend on the frame before, they are found in order and the output is the same for any n
+    void set_threads(size_t n);
+    // write the pixels of a frame's rect that did not change as transparent, drawn over the frame before (disposal 1)
+    // the runs of the transparent index compress well, at the cost of one palette color in PALETTE_ADAPTIVE
+    void set_transparency(bool enabled);
+    // write up to n disjoint dirty rects per frame, each as its own image with a delay of 0 but the last
+    // changes far apart then do not force encoding everything between them,
+    // but some players hold images with a delay of 0 for a minimum time, so it defaults to 1
+    void set_max_rects(size_t n);
+    // each frame is w * h packed rgb bytes
+    void encode(const std::vector<std::string>& frames);
+};
+
+void gif_encode(const std::vector<std::string>& frames, uint16_t w, uint16_t h, ByteSink& out, palette_mode_t palette_mode = PALETTE_FIXED, size_t n_threads = 0, bool transparency = false);
+// write to stdout, returns 0 or the errno of a failed write
+int gif_encode(const std::vector<std::string>& frames, uint16_t w, uint16_t h, palette_mode_t palette_mode = PALETTE_FIXED, size_t n_threads = 0, bool transparency = false);
+
+#endif
@@ -0,0 +1,84 @@
+#include "gifplayer.h"
+
+// browsers show frames with a delay below 2/100 s for 1/10 s, so does this player
+#define MIN_DELAY_CS 2
+#define DEFAULT_DELAY_CS 10
+
+GifPlayer::GifPlayer(GifDecoder& _decoder, size_t ring_size): decoder(_decoder), ring(ring_size) {
+    assert(ring_size > 0 && "ring size must be positive");
+    this->producer = std::thread(&GifPlayer::produce, this);
+}
+
+GifPlayer::~GifPlayer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    this->producer.join();
+}
+
+void GifPlayer::produce() {
+    size_t row_size = (size_t)this->decoder.get_width() * this->decoder.bytes_per_pixel();
+    uint16_t h = this->decoder.get_height();
+    while (true) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [this]() { return this->stopping || this->count < this->ring.size(); });
+            if (this->stopping) {
+                return;
+            }
+            slot = (this->head + this->count) % this->ring.size();
+        }
+        // the slot is not visible to the consumer until count grows, so it is filled without the lock
+        if (this->decoder.decode_frame()) {
+            this->decoder.loop();
+            if (this->decoder.decode_frame()) {
+                // no frames at all
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->finished = true;
+                }
+                this->cv.notify_all();
+                return;
+            }
+        }
+        assert(this->decoder.get_canvas() && "the player needs a decoder with a canvas");
+        playback_frame_t& frame = this->ring[slot];
+        // pixels are packed rows, whatever the stride of the decoder's canvas
+        frame.pixels.resize(row_size * h);
+        for (uint16_t y = 0; y < h; y++) {
+            memcpy(frame.pixels.data() + y * row_size, this->decoder.get_canvas() + y * this->decoder.get_stride(), row_size);
+        }
+        frame.dirty = this->decoder.get_dirty_rect();
+        uint16_t delay = this->decoder.get_delay();
+        frame.delay_ms = (delay < MIN_DELAY_CS ? DEFAULT_DELAY_CS : delay) * 10;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->count++;
+        }
+        this->cv.notify_all();
+    }
+}
+
+const playback_frame_t* GifPlayer::front() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [this]() { return this->count > 0 || this->finished; });
+    return this->count > 0 ? &this->ring[this->head] : nullptr;
+}
+
+size_t GifPlayer::ready() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->count;
+}
+
+void GifPlayer::pop() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        assert(this->count > 0 && "pop on an empty ring");
+        this->head = (this->head + 1) % this->ring.size();
+        this->count--;
+    }
+    this->cv.notify_all();
+}
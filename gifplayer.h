@@ -0,0 +1,46 @@
+#ifndef GIF_PLAYER
+#define GIF_PLAYER
+
+#include "gifdec.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// a decoded frame waiting to be presented
+typedef struct {
+    vector<unsigned char> pixels; // the whole canvas in the decoder's pix_fmt, rows packed
+    rect_t dirty; // the area changed since the previous frame
+    uint32_t delay_ms; // how long the frame stays on screen
+} playback_frame_t;
+
+// decodes ahead on a producer thread into a small ring of frames, looping forever
+// the consumer takes frames in order with front() / pop() and decides when to present them
+class GifPlayer {
+    GifDecoder& decoder;
+    vector<playback_frame_t> ring;
+    size_t head{}; // the oldest decoded frame
+    size_t count{}; // the number of decoded frames in the ring
+    bool stopping{};
+    bool finished{}; // the producer stopped on its own, the gif has no frames
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread producer;
+
+    void produce();
+public:
+    // the decoder is owned by the producer thread until the player is destroyed
+    GifPlayer(GifDecoder& decoder, size_t ring_size);
+    GifPlayer(const GifPlayer&) = delete;
+    GifPlayer& operator=(const GifPlayer&) = delete;
+    ~GifPlayer();
+
+    // the oldest decoded frame, waiting for the producer if the ring is empty
+    // returns nullptr only when the gif has no frames
+    const playback_frame_t* front();
+    // the number of decoded frames ready without waiting
+    size_t ready();
+    // release the oldest frame back to the producer
+    void pop();
+};
+
+#endif
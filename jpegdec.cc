@@ -10,8 +10,6 @@
 #include "huffman.h"
 #include "node.h"
 
-char buf[16];
-
 const uint8_t zigzag[] = {
 	0,	1,	5,	6,	14,	15,	27,	28,
  	2,	4,	7,	13,	16,	26,	29,	42,
@@ -204,10 +202,10 @@ void JpegDecoder::handle_restart() {
 void JpegDecoder::handle_sof0() {
   segment_info_t info = this->segments[segment_t::SOF0][0]; // only one sof0 segment
   this->file.seekg(info.offset, ios::beg);
-  read_assert_str_equal(this->file, buf, "\x08", "data precision not 8");
+  read_assert_str_equal(this->file, this->buf, "\x08", "data precision not 8");
   this->h = read_u16_be(this->file);
   this->w = read_u16_be(this->file);
-  read_assert_str_equal(this->file, buf, "\x03", "image component not 3");
+  read_assert_str_equal(this->file, this->buf, "\x03", "image component not 3");
   this->file.read((char*)&this->frame_components[0], 9);
 
   int* buf_ptr;
@@ -320,7 +318,7 @@ void JpegDecoder::handle_sof0() {
 void JpegDecoder::handle_sos() {
   segment_info_t info = this->segments[segment_t::SOS][0]; // only one sos segment
   this->file.seekg(info.offset, ios::beg);
-  read_assert_str_equal(this->file, buf, "\x03", "image component not 3");
+  read_assert_str_equal(this->file, this->buf, "\x03", "image component not 3");
   this->file.read((char*)&this->scan_components[0], 6);
   // remaining data in sos segment is not for baseline dct - ignored
 }
@@ -394,7 +392,7 @@ void JpegDecoder::handle_define_quantization_table(long long offset, int length)
 
 void JpegDecoder::get_segments() {
   // start of image
-  read_assert_str_equal(this->file, buf, "\xff\xd8", "start of image header error");
+  read_assert_str_equal(this->file, this->buf, "\xff\xd8", "start of image header error");
 
   char marker[2];
   int seg_length;
@@ -76,6 +76,7 @@ typedef struct {
 
 class JpegDecoder {
   ifstream file;
+  char buf[16]; // a temp buffer for file content
 
   // buffers
   vector<int*> y_bufs;
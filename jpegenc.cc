@@ -10,10 +10,6 @@
 #include <string>
 #include <vector>
 
-float temp1[64];
-float temp2[64];
-std::vector<std::pair<uint8_t, int>> rle_results;
-
 const uint8_t zigzag[] = {
 	0,	1,	5,	6,	14,	15,	27,	28,
  	2,	4,	7,	13,	16,	26,	29,	42,
@@ -62,7 +58,7 @@ void dct_8x8(const float* time_domain_input, float* freq_domain_output) {
   }
 }
 
-JpegEncoder::JpegEncoder(const char* filename): file(filename) {
+JpegEncoder::JpegEncoder(const char* filename, ByteSink& _out): file(filename), out(_out) {
   assert(this->file.is_open() && "open file error");
   this->read_as_ppm();
   this->encode();
@@ -109,52 +105,54 @@ void JpegEncoder::read_as_ppm() {
 }
 
 void JpegEncoder::output_qt(bool is_chroma, const uint8_t* table) {
-    printf("%c", is_chroma ? 1 : 0);
-    fwrite(table, sizeof(unsigned char), 64, stdout);
+    this->out.put(is_chroma ? 1 : 0);
+    this->out.write(table, 64);
 }
 
 void JpegEncoder::output_hts() {
-    printf("\xff\xc4");
+    this->out.write("\xff\xc4", 2);
     uint16_t length = 0;
-    std::stringstream total;
+    std::string total;
     this->output_ht(false, false, this->ht_luma_dc, &length, total);
     this->output_ht(false, true, this->ht_luma_ac, &length, total);
     this->output_ht(true, false, this->ht_chroma_dc, &length, total);
     this->output_ht(true, true, this->ht_chroma_ac, &length, total);
-    write_u16_be(length + 2);
-    std::cout << total.str();
+    this->out.write_u16_be(length + 2);
+    this->out.write(total);
 }
 
-void JpegEncoder::output_ht(bool is_chroma, bool is_ac, const HuffmanEnc& table, uint16_t* total_length, std::stringstream& total) {
+void JpegEncoder::output_ht(bool is_chroma, bool is_ac, const HuffmanEnc& table, uint16_t* total_length, std::string& total) {
     uint8_t dest = (is_ac << 4) | is_chroma;
     const auto [ nb_syms, symbols ] = table.to_spec();
-    total << dest << nb_syms << symbols;
+    total += (char)dest;
+    total += nb_syms;
+    total += symbols;
     *total_length = *total_length + nb_syms.size() + symbols.size() + 1;
     // fwrite(table, sizeof(unsigned char), 64, stdout);
 }
 
 void JpegEncoder::output_sof() {
-    printf("\xff\xc0");
-    write_u16_be(17); // for 3-component jpeg
-    printf("\x08"); // 8-bit precision
-    write_u16_be(this->h); // height first
-    write_u16_be(this->w);
-    printf("\x03"); // 3-component
+    this->out.write("\xff\xc0", 2);
+    this->out.write_u16_be(17); // for 3-component jpeg
+    this->out.put(0x08); // 8-bit precision
+    this->out.write_u16_be(this->h); // height first
+    this->out.write_u16_be(this->w);
+    this->out.put(0x03); // 3-component
     // 420 sampling
-    fwrite("\x01\x22\x00", 1, 3, stdout); 
-    fwrite("\x02\x11\x01", 1, 3, stdout);
-    fwrite("\x03\x11\x01", 1, 3, stdout);
+    this->out.write("\x01\x22\x00", 3);
+    this->out.write("\x02\x11\x01", 3);
+    this->out.write("\x03\x11\x01", 3);
 }
 
 void JpegEncoder::output_sos() {
-    printf("\xff\xda");
-    write_u16_be(12); // for 3-component jpeg
-    printf("\x03"); // 3-component
+    this->out.write("\xff\xda", 2);
+    this->out.write_u16_be(12); // for 3-component jpeg
+    this->out.put(0x03); // 3-component
     // 420 sampling
-    fwrite("\x01\x00", 1, 2, stdout); 
-    printf("\x02\x11");
-    printf("\x03\x11");
-    fwrite("\x00\x3f\x00", 1, 3, stdout); // for baseline dct
+    this->out.write("\x01\x00", 2);
+    this->out.write("\x02\x11", 2);
+    this->out.write("\x03\x11", 2);
+    this->out.write("\x00\x3f\x00", 3); // for baseline dct
 }
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
@@ -239,6 +237,8 @@ int JpegEncoder::encode_8x8_per_component(
 ) {
     // 420 sampling
     uint8_t mcu_w = 16;
+    float* temp1 = this->temp1;
+    float* temp2 = this->temp2;
     fill_8x8(src_buffer, temp1, x, y, sample_h, sample_v, mcu_w);
     dct_8x8(temp1, temp2);
     zigzag_rearrange_8x8(temp2, temp1);
@@ -259,8 +259,8 @@ int JpegEncoder::encode_8x8_per_component(
     }
 
     // encode ac
-    rle_63(temp2 + 1, rle_results);
-    for (auto rle: rle_results) {
+    rle_63(temp2 + 1, this->rle_results);
+    for (auto rle: this->rle_results) {
         const int ac_coeff = rle.second;
         unsigned char zero_length = rle.first;
         if (zero_length == 0 && ac_coeff == 0) {
@@ -321,7 +321,7 @@ void JpegEncoder::output_encoded_image_data() {
             dc_cr = this->encode_8x8_per_component(this->Cr_MCU, 0, 0, 2, 2, true, dc_cr);
         }
     }
-    std::cout << this->bitstream.store;
+    this->out.write(this->bitstream.store);
 }
 
 // quantization tables should be transformed according to "quality" parameter
@@ -340,25 +340,25 @@ void JpegEncoder::init_ht_tables() {
 }
 
 void JpegEncoder::output_app0() {
-    printf("\xff\xe0");
-    write_u16_be(16);
-    fwrite("JFIF\x00",1,5,stdout);
-
-    fwrite("\x01\x01\x00",1, 3, stdout);
-    write_u16_be(1);
-    write_u16_be(1);
-    fwrite("\x00\x00",1, 2, stdout);
+    this->out.write("\xff\xe0", 2);
+    this->out.write_u16_be(16);
+    this->out.write("JFIF\x00", 5);
+
+    this->out.write("\x01\x01\x00", 3);
+    this->out.write_u16_be(1);
+    this->out.write_u16_be(1);
+    this->out.write("\x00\x00", 2);
 }
 
 void JpegEncoder::encode() {
     this->init_qt_tables();
     this->init_ht_tables();
     
-    printf("\xff\xd8"); // start of image
+    this->out.write("\xff\xd8", 2); // start of image
 
     // quantization tables
-    printf("\xff\xdb");
-    write_u16_be(132); // 64*2 + 2 + 2;
+    this->out.write("\xff\xdb", 2);
+    this->out.write_u16_be(132); // 64*2 + 2 + 2;
     this->output_qt(false, this->qt_luma);
     this->output_qt(true, this->qt_chroma);
 
@@ -368,5 +368,6 @@ void JpegEncoder::encode() {
     this->output_hts();
     this->output_sos();
     this->output_encoded_image_data();
-    printf("\xff\xd9"); // end of image
+    this->out.write("\xff\xd9", 2); // end of image
+    this->out.flush();
 }
@@ -31,13 +31,15 @@
 #define JPEG_ENC
 
 #include <fstream>
-#include <sstream>
+#include <vector>
+#include "bytesink.h"
 #include "jpeg_tables.h"
 #include "bitstream.h"
 #include "huffman_enc.h"
 
 class JpegEncoder {
     std::ifstream file;
+    ByteSink& out;
     size_t w, h;
     // source buffers
     unsigned char* r;
@@ -48,6 +50,10 @@ class JpegEncoder {
     char* Cr_MCU;
 
     BitStream bitstream;
+    // scratch buffers for encoding each 8x8 block
+    float temp1[64];
+    float temp2[64];
+    std::vector<std::pair<uint8_t, int>> rle_results;
 
     const uint8_t* qt_luma;
     const uint8_t* qt_chroma;
@@ -65,12 +71,13 @@ class JpegEncoder {
     void output_app0();
     void output_qt(bool is_chroma, const uint8_t* table);
     void output_hts();
-    void output_ht(bool is_chroma, bool is_ac, const HuffmanEnc& table, uint16_t* total_length, std::stringstream& total);
+    void output_ht(bool is_chroma, bool is_ac, const HuffmanEnc& table, uint16_t* total_length, std::string& total);
     void output_sof();
     void output_sos();
     void output_encoded_image_data();
 public:
-    JpegEncoder(const char* filename);
+    // encodes the ppm file right away, writing the jpeg to out
+    JpegEncoder(const char* filename, ByteSink& out);
     ~JpegEncoder();
     void encode();
 };
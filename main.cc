@@ -1,9 +1,17 @@
 #include "jpegenc.h"
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <unistd.h>
 
 int main(int argc, char** argv) {
   assert(argc >= 2 && "no input file");
   char* filename = argv[1];
-  JpegEncoder encoder(filename);
+  ByteSink out(STDOUT_FILENO);
+  JpegEncoder encoder(filename, out);
+  out.flush();
+  if (out.get_error()) {
+    fprintf(stderr, "write error: %s\n", strerror(out.get_error()));
+    return 1;
+  }
 }
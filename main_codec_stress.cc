@@ -0,0 +1,124 @@
+#include "gifdec.h"
+#include "gifenc.h"
+#include "jpegenc.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// run many decoders and encoders at once, each on its own thread, and check every output against a single-threaded run
+// usage: codec_stress <gif file> <ppm file> [threads per codec] [rounds]
+// encoders write to memory sinks, so a failure points at state shared between codec instances
+
+// the canvas after every frame, in ARGB
+static string decode_gif(const char* filename, file_mode_t file_mode) {
+    GifDecoder gd(filename, pix_fmt_t::ARGB, file_mode);
+    size_t frame_size = (size_t)gd.get_width() * gd.get_height() * 4;
+    string frames;
+    while (!gd.decode_frame()) {
+        frames.append((const char*)gd.get_canvas(), frame_size);
+    }
+    return frames;
+}
+
+static string encode_gif(const vector<string>& frames, uint16_t w, uint16_t h, palette_mode_t palette_mode, bool transparency) {
+    string bytes;
+    {
+        ByteSink out(bytes);
+        GifEncoder encoder(w, h, out, palette_mode);
+        encoder.set_threads(1);
+        encoder.set_transparency(transparency);
+        encoder.encode(frames);
+    }
+    return bytes;
+}
+
+static string encode_jpeg(const char* filename) {
+    string bytes;
+    {
+        ByteSink out(bytes);
+        JpegEncoder encoder(filename, out);
+    }
+    return bytes;
+}
+
+// a gradient with a box moving over it
+static vector<string> make_frames(uint16_t w, uint16_t h, size_t n_frames) {
+    vector<string> frames;
+    for (size_t t = 0; t < n_frames; t++) {
+        string frame((size_t)w * h * 3, 0);
+        for (uint16_t y = 0; y < h; y++) {
+            for (uint16_t x = 0; x < w; x++) {
+                uint8_t* p = (uint8_t*)&frame[((size_t)y * w + x) * 3];
+                bool in_box = x >= t * 8 && x < t * 8 + 24 && y >= h / 3 && y < h / 3 + 24;
+                p[0] = in_box ? 255 : x * 255 / w;
+                p[1] = in_box ? 255 : y * 255 / h;
+                p[2] = (t * 32) & 0xff;
+            }
+        }
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+int main(int argc, char** argv) {
+    assert(argc >= 3 && "usage: codec_stress <gif file> <ppm file> [threads per codec] [rounds]");
+    const char* gif_file = argv[1];
+    const char* ppm_file = argv[2];
+    size_t n_threads = argc >= 4 ? atoi(argv[3]) : 4;
+    size_t rounds = argc >= 5 ? atoi(argv[4]) : 20;
+
+    uint16_t w = 160;
+    uint16_t h = 120;
+    vector<string> frames = make_frames(w, h, 8);
+
+    // single-threaded references
+    string decoded = decode_gif(gif_file, FILE_READ);
+    string encoded[2][2];
+    for (int adaptive = 0; adaptive < 2; adaptive++) {
+        for (int transparency = 0; transparency < 2; transparency++) {
+            encoded[adaptive][transparency] = encode_gif(frames, w, h, adaptive ? PALETTE_ADAPTIVE : PALETTE_FIXED, transparency);
+        }
+    }
+    string jpeg = encode_jpeg(ppm_file);
+
+    std::atomic<size_t> runs{};
+    std::atomic<size_t> failures{};
+    auto check = [&](const string& output, const string& reference, const char* codec, size_t thread) {
+        runs++;
+        if (output != reference) {
+            failures++;
+            fprintf(stderr, "%s on thread %zu: output differs from the single-threaded run\n", codec, thread);
+        }
+    };
+
+    // every thread cycles through the configurations of its codec, so that different ones overlap
+    vector<std::thread> threads;
+    for (size_t i = 0; i < n_threads; i++) {
+        threads.emplace_back([&, i]() {
+            for (size_t round = 0; round < rounds; round++) {
+                file_mode_t file_mode = (i + round) % 2 ? FILE_MMAP : FILE_READ;
+                check(decode_gif(gif_file, file_mode), decoded, "GifDecoder", i);
+            }
+        });
+        threads.emplace_back([&, i]() {
+            for (size_t round = 0; round < rounds; round++) {
+                int adaptive = (i + round) % 2;
+                int transparency = (i + round) / 2 % 2;
+                string output = encode_gif(frames, w, h, adaptive ? PALETTE_ADAPTIVE : PALETTE_FIXED, transparency);
+                check(output, encoded[adaptive][transparency], "GifEncoder", i);
+            }
+        });
+        threads.emplace_back([&, i]() {
+            for (size_t round = 0; round < rounds; round++) {
+                check(encode_jpeg(ppm_file), jpeg, "JpegEncoder", i);
+            }
+        });
+    }
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    printf("%zu runs on %zu threads, %zu failures\n", runs.load(), threads.size(), failures.load());
+    return failures > 0;
+}
@@ -0,0 +1,108 @@
+#include "gifdec.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+// decode many gifs on a thread pool and report the throughput and per-file latency
+// usage: gif_batch [-j threads] [-m manifest] [-o outdir] [file]...
+// a manifest lists one file per line, with -o the frames of each file are written to outdir/<index>_<name>.raw as ARGB
+// where index is the position of the file among the inputs, so that files of the same name do not collide
+
+typedef struct {
+    size_t frames;
+    double mpixels;
+    double ms; // wall time decoding the file
+    bool write_error; // the raw output is incomplete
+} file_result_t;
+
+static file_result_t decode_file(const string& filename, size_t index, const char* outdir) {
+    auto start = std::chrono::steady_clock::now();
+    GifDecoder gd(filename.c_str(), pix_fmt_t::ARGB, FILE_MMAP);
+    size_t frame_size = (size_t)gd.get_width() * gd.get_height() * 4;
+
+    FILE* out = nullptr;
+    if (outdir) {
+        size_t slash = filename.find_last_of('/');
+        string name = filename.substr(slash == string::npos ? 0 : slash + 1);
+        out = fopen((string(outdir) + "/" + std::to_string(index) + "_" + name + ".raw").c_str(), "wb");
+        assert(out && "open output file error");
+    }
+    file_result_t result{};
+    while (!gd.decode_frame()) {
+        if (out && !result.write_error && fwrite(gd.get_canvas(), 1, frame_size, out) != frame_size) {
+            result.write_error = true;
+        }
+        result.frames++;
+    }
+    if (out && fclose(out) != 0) {
+        result.write_error = true;
+    }
+    result.mpixels = (double)result.frames * frame_size / 4 / 1e6;
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    size_t threads = 0;
+    const char* outdir = nullptr;
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outdir = argv[++i];
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            std::ifstream manifest(argv[++i]);
+            assert(manifest.is_open() && "open manifest error");
+            string line;
+            while (std::getline(manifest, line)) {
+                if (!line.empty()) {
+                    files.push_back(line);
+                }
+            }
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    assert(!files.empty() && "no input file");
+
+    // one task per file, idle workers take the next file from the shared queue
+    vector<file_result_t> results(files.size());
+    auto start = std::chrono::steady_clock::now();
+    size_t n_threads;
+    {
+        ThreadPool pool(threads);
+        n_threads = pool.size();
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.post([&, i]() { results[i] = decode_file(files[i], i, outdir); });
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t n_frame = 0;
+    double mpixels = 0;
+    vector<double> latencies;
+    size_t n_write_error = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const file_result_t& result = results[i];
+        if (result.write_error) {
+            fprintf(stderr, "%s: error writing frames\n", files[i].c_str());
+            n_write_error++;
+        }
+        n_frame += result.frames;
+        mpixels += result.mpixels;
+        latencies.push_back(result.ms);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+    };
+    printf("%zu files (%zu threads): %zu frames in %.3fs, %.1f frames/s, %.1f MP/s\n",
+        files.size(), n_threads, n_frame, seconds, n_frame / seconds, mpixels / seconds);
+    printf("per-file latency: p50 %.2fms, p99 %.2fms, max %.2fms\n", percentile(0.5), percentile(0.99), latencies.back());
+    return n_write_error > 0;
+}
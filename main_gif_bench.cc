@@ -0,0 +1,53 @@
+#include "gifdec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+// decode every frame of a gif for a number of rounds and report the throughput
+// usage: gif_bench <file> [rounds] [read|mmap|memory] [threads]
+// with threads > 0, lzw decoding of frames is spread over that many threads
+// testdata/truncated_sub_block.gif ends right after the length byte of its last sub-block,
+// and must decode in every mode without reading past the end of the data
+int main(int argc, char** argv) {
+    assert(argc >= 2 && "no input file");
+    char* filename = argv[1];
+    int rounds = argc >= 3 ? atoi(argv[2]) : 10;
+    const char* mode = argc >= 4 ? argv[3] : "read";
+    int threads = argc >= 5 ? atoi(argv[4]) : 0;
+
+    // for memory mode, the bytes are loaded before the decoder is created
+    std::ifstream file(filename, std::ios::binary);
+    std::string bytes;
+    std::unique_ptr<GifDecoder> gd;
+    if (!strcmp(mode, "memory")) {
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        gd = std::make_unique<GifDecoder>(std::span((const uint8_t*)bytes.data(), bytes.size()), pix_fmt_t::ARGB);
+    } else {
+        gd = std::make_unique<GifDecoder>(filename, pix_fmt_t::ARGB, !strcmp(mode, "mmap") ? FILE_MMAP : FILE_READ);
+    }
+    uint16_t w = gd->get_width();
+    uint16_t h = gd->get_height();
+
+    size_t n_frame = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        if (threads > 0) {
+            gd->decode_frames_parallel(threads, [&](size_t) { n_frame++; });
+        } else {
+            while (!gd->decode_frame()) {
+                n_frame++;
+            }
+        }
+        gd->loop();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double mpixels = (double)n_frame * w * h / 1e6;
+    printf("%s (%s, %d threads): %dx%d, %zu frames in %.3fs, %.1f frames/s, %.1f MP/s\n",
+        filename, mode, threads, w, h, n_frame, seconds, n_frame / seconds, mpixels / seconds);
+}
@@ -1,12 +1,19 @@
 #include "gifdec.h"
+#include "gifplayer.h"
 #include <SDL2/SDL.h>
 #include <sstream>
 
+// the number of frames decoded ahead of the one on screen
+#define DECODE_AHEAD 4
+// memory kept for replaying frames on later loops instead of decoding them again
+#define FRAME_CACHE_BUDGET (64 << 20)
+
 int main(int argc, char** argv) {
     assert(argc >= 2 && "no input file");
     char* filename = argv[1];
 
     GifDecoder gd(filename, pix_fmt_t::ARGB);
+    gd.set_frame_cache(FRAME_CACHE_BUDGET);
     uint16_t w = gd.get_width();
     uint16_t h = gd.get_height();
 
@@ -15,32 +22,60 @@ int main(int argc, char** argv) {
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGRA8888, SDL_TEXTUREACCESS_STREAMING, w, h);
 
+    // frames are decoded on the player's thread, this thread only presents them when they are due
+    GifPlayer player(gd, DECODE_AHEAD);
     SDL_Event e;
-    int pitch;
+    uint64_t due = SDL_GetTicks64(); // when the next frame should be presented, in ms
 poll:
     while (true) {
-        if (SDL_PollEvent(&e)) {
+        // sleep in the event queue until the next frame is due
+        uint64_t now = SDL_GetTicks64();
+        if (SDL_WaitEventTimeout(&e, due > now ? (int)(due - now) : 0)) {
             if (e.type == SDL_QUIT) {
                 goto end;
             }
             if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
                 goto wait;
             }
+            continue;
         }
-        SDL_LockTexture(texture, nullptr, (void**)&gd.buffer, &pitch);
-        bool eof = gd.decode_frame();
-        if (eof) {
-            gd.loop();
+        now = SDL_GetTicks64();
+        if (now < due) {
             continue;
         }
-        SDL_UnlockTexture(texture);
+        const playback_frame_t* frame = player.front();
+        if (!frame) {
+            goto end;
+        }
+        // when behind, drop frames whose display time already passed as long as a later frame is decoded
+        rect_t dirty = frame->dirty;
+        while (due + frame->delay_ms <= now && player.ready() > 1) {
+            due += frame->delay_ms;
+            player.pop();
+            frame = player.front();
+            dirty = union_rect(dirty, frame->dirty);
+        }
+        // upload only the area changed since the last presented frame
+        if (dirty.w > 0 && dirty.h > 0) {
+            SDL_Rect rect = { dirty.l, dirty.t, dirty.w, dirty.h };
+            SDL_UpdateTexture(texture, &rect, frame->pixels.data() + ((size_t)dirty.t * w + dirty.l) * 4, w * 4);
+        }
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
+        due += frame->delay_ms;
+        if (due < now) {
+            due = now; // nothing left to drop, restart the timing from here
+        }
+        player.pop();
     }
 wait:
     while (true) {
         if (SDL_WaitEvent(&e)) {
+            if (e.type == SDL_QUIT) {
+                goto end;
+            }
             if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_FOCUS_GAINED) {
+                due = SDL_GetTicks64();
                 goto poll;
             }
         }
@@ -0,0 +1,48 @@
+#include "gifenc.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+typedef struct {
+    char r;
+    char g;
+    char b;
+} rgb_t;
+
+string get_frame(uint16_t width, uint16_t height, size_t t, rgb_t (*fn)(uint16_t left, uint16_t top, uint16_t width, uint16_t height, size_t t)) {
+    string output_frame;
+    for (uint16_t top = 0; top < height; top++) {
+        for (uint16_t left = 0; left < width; left++) {
+            rgb_t rgb = fn(left, top, width, height, t);
+            output_frame += rgb.r;
+            output_frame += rgb.g;
+            output_frame += rgb.b;
+        }
+    }
+    return output_frame;
+}
+
+int main() {
+    uint16_t W = 32;
+    uint16_t H = 32;
+    auto shader = [](uint16_t left, uint16_t top, uint16_t width, uint16_t height, size_t t) -> rgb_t {
+        char r = (char)((float)left / (float)width * 255.0);
+        char g = (char)((float)top / (float)height * 255.0);
+        char b = (char)t;
+        return rgb_t { r, g, b };
+    };
+
+    // todo infinite loop when t = 0,1,2
+    vector<string> frames = {
+        get_frame(W, H, 0, shader),
+        get_frame(W, H, 127, shader),
+        get_frame(W, H, 255, shader)
+    };
+
+    if (int error = gif_encode(frames, W, H)) {
+        fprintf(stderr, "write error: %s\n", strerror(error));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include "gifdec.h"
+#include <cstdio>
+
+// print the canvas size, frame count, duration and loop count of gifs without decoding their frames
+// usage: gif_probe <file>... [-v]
+// with -v, the delay of every frame is listed as well
+int main(int argc, char** argv) {
+    assert(argc >= 2 && "no input file");
+    bool verbose = !strcmp(argv[argc - 1], "-v");
+    int n_files = verbose ? argc - 2 : argc - 1;
+
+    for (int i = 1; i <= n_files; i++) {
+        GifDecoder gd(argv[i], pix_fmt_t::ARGB, FILE_MMAP);
+        gif_probe_t probe = gd.probe();
+        printf("%s: %dx%d, %zu frames, %.2fs, loop %d\n",
+            argv[i], probe.w, probe.h, probe.n_frames, probe.duration / 100.0, probe.loop_count);
+        if (verbose) {
+            for (size_t n = 0; n < probe.delays.size(); n++) {
+                printf("  frame %zu: %dcs\n", n, probe.delays[n]);
+            }
+        }
+    }
+}
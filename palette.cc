@@ -0,0 +1,124 @@
+#include "palette.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PALETTE_X86
+#endif
+
+static void expand_indexes_32_scalar(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index) {
+    uint32_t* out = (uint32_t*)dst;
+    if (tran_index < 0) {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(out + i, palette + indexes[i], 4);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (indexes[i] != tran_index) {
+            memcpy(out + i, palette + indexes[i], 4);
+        }
+    }
+}
+
+#ifdef PALETTE_X86
+// no gather in sse2, the 4 entries are loaded one by one and the transparent lanes are blended with the old pixels
+__attribute__((target("sse2")))
+static void expand_indexes_32_sse2(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index) {
+    size_t i = 0;
+    __m128i tran = _mm_set1_epi32(tran_index);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        const uint8_t* p = indexes + i;
+        __m128i colors = _mm_set_epi32(palette[p[3]], palette[p[2]], palette[p[1]], palette[p[0]]);
+        if (tran_index >= 0) {
+            uint32_t packed;
+            memcpy(&packed, p, 4);
+            __m128i idx = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+            __m128i mask = _mm_cmpeq_epi32(idx, tran);
+            __m128i old = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+            colors = _mm_or_si128(_mm_and_si128(mask, old), _mm_andnot_si128(mask, colors));
+        }
+        _mm_storeu_si128((__m128i*)(dst + i * 4), colors);
+    }
+    expand_indexes_32_scalar(indexes + i, dst + i * 4, n - i, palette, tran_index);
+}
+
+__attribute__((target("avx2")))
+static void expand_indexes_32_avx2(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index) {
+    size_t i = 0;
+    __m256i tran = _mm256_set1_epi32(tran_index);
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(indexes + i)));
+        __m256i colors = _mm256_i32gather_epi32((const int*)palette, idx, 4);
+        if (tran_index >= 0) {
+            __m256i mask = _mm256_cmpeq_epi32(idx, tran);
+            __m256i old = _mm256_loadu_si256((const __m256i*)(dst + i * 4));
+            colors = _mm256_blendv_epi8(colors, old, mask);
+        }
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), colors);
+    }
+    expand_indexes_32_scalar(indexes + i, dst + i * 4, n - i, palette, tran_index);
+}
+#endif
+
+typedef void (*expand_fn_t)(const uint8_t*, uint8_t*, size_t, const uint32_t*, int);
+
+typedef struct {
+    expand_fn_t fn;
+    const char* name;
+} expand_kernel_t;
+
+static expand_kernel_t select_expand_indexes_32() {
+#ifdef PALETTE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { expand_indexes_32_avx2, "avx2" };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return { expand_indexes_32_sse2, "sse2" };
+    }
+#endif
+    return { expand_indexes_32_scalar, "scalar" };
+}
+
+static const expand_kernel_t expand_kernel_32 = select_expand_indexes_32();
+
+void expand_indexes_32(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index) {
+    expand_kernel_32.fn(indexes, dst, n, palette, tran_index);
+}
+
+const char* expand_indexes_32_isa() {
+    return expand_kernel_32.name;
+}
+
+void expand_indexes_24(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index) {
+    if (n == 0) {
+        return;
+    }
+    if (tran_index < 0) {
+        // 4-byte stores, each overlapping byte is overwritten by the next pixel
+        for (size_t i = 0; i + 1 < n; i++) {
+            memcpy(dst + i * 3, palette + indexes[i], 4);
+        }
+        memcpy(dst + (n - 1) * 3, palette + indexes[n - 1], 3);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (indexes[i] != tran_index) {
+            memcpy(dst + i * 3, palette + indexes[i], 3);
+        }
+    }
+}
+
+void copy_indexes(const uint8_t* indexes, uint8_t* dst, size_t n, int tran_index) {
+    if (tran_index < 0) {
+        memcpy(dst, indexes, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (indexes[i] != tran_index) {
+            dst[i] = indexes[i];
+        }
+    }
+}
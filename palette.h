@@ -0,0 +1,18 @@
+#ifndef PALETTE
+#define PALETTE
+
+#include <cstddef>
+#include <cstdint>
+
+// expand a row of color indexes into pixels through a 256-entry palette
+// each palette entry holds the output pixel bytes in memory order (only 3 bytes are used by the 24-bit variant)
+// pixels whose index equals tran_index are left untouched, pass -1 when there is no transparent index
+void expand_indexes_32(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index);
+void expand_indexes_24(const uint8_t* indexes, uint8_t* dst, size_t n, const uint32_t* palette, int tran_index);
+// copy a row of color indexes as they are, for indexed output
+void copy_indexes(const uint8_t* indexes, uint8_t* dst, size_t n, int tran_index);
+
+// the name of the 32-bit expansion kernel selected for this cpu
+const char* expand_indexes_32_isa();
+
+#endif
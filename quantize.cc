@@ -0,0 +1,135 @@
+#include "quantize.h"
+#include <vector>
+
+void add_to_histogram(const uint8_t* rgb, size_t n_pixels, size_t step, uint32_t* histogram) {
+    for (size_t i = 0; i < n_pixels; i += step) {
+        const uint8_t* pixel = rgb + i * 3;
+        histogram[rgb15(pixel[0], pixel[1], pixel[2])]++;
+    }
+}
+
+// a box of 15-bit colors, bounds are inclusive 5-bit values of r, g, b
+typedef struct {
+    uint8_t lo[3];
+    uint8_t hi[3];
+    uint64_t count; // pixels counted in the box
+    uint8_t occupied_lo[3]; // bounds of the colors with a non zero count
+    uint8_t occupied_hi[3];
+} color_box_t;
+
+static uint16_t box_color(const uint8_t* c) {
+    return c[0] << 10 | c[1] << 5 | c[2];
+}
+
+// count the box and shrink its occupied bounds to the colors present
+static void measure_box(const uint32_t* histogram, color_box_t& box) {
+    box.count = 0;
+    for (int k = 0; k < 3; k++) {
+        box.occupied_lo[k] = 31;
+        box.occupied_hi[k] = 0;
+    }
+    uint8_t c[3];
+    for (c[0] = box.lo[0]; c[0] <= box.hi[0]; c[0]++) {
+        for (c[1] = box.lo[1]; c[1] <= box.hi[1]; c[1]++) {
+            for (c[2] = box.lo[2]; c[2] <= box.hi[2]; c[2]++) {
+                uint32_t n = histogram[box_color(c)];
+                if (n == 0) {
+                    continue;
+                }
+                box.count += n;
+                for (int k = 0; k < 3; k++) {
+                    box.occupied_lo[k] = c[k] < box.occupied_lo[k] ? c[k] : box.occupied_lo[k];
+                    box.occupied_hi[k] = c[k] > box.occupied_hi[k] ? c[k] : box.occupied_hi[k];
+                }
+            }
+        }
+    }
+}
+
+// split the box in two at the median of its longest occupied axis
+static color_box_t split_box(const uint32_t* histogram, color_box_t& box) {
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (box.occupied_hi[k] - box.occupied_lo[k] > box.occupied_hi[axis] - box.occupied_lo[axis]) {
+            axis = k;
+        }
+    }
+    // pixels in each slice of the box along the axis
+    uint64_t slices[32] = {};
+    uint8_t c[3];
+    for (c[0] = box.lo[0]; c[0] <= box.hi[0]; c[0]++) {
+        for (c[1] = box.lo[1]; c[1] <= box.hi[1]; c[1]++) {
+            for (c[2] = box.lo[2]; c[2] <= box.hi[2]; c[2]++) {
+                slices[c[axis]] += histogram[box_color(c)];
+            }
+        }
+    }
+    // the cut is kept within the occupied range, so that both halves hold some colors
+    uint8_t cut = box.occupied_lo[axis];
+    uint64_t below = slices[cut];
+    while (cut + 1 < box.occupied_hi[axis] && below * 2 < box.count) {
+        below += slices[++cut];
+    }
+    color_box_t upper = box;
+    box.hi[axis] = cut;
+    upper.lo[axis] = cut + 1;
+    measure_box(histogram, box);
+    measure_box(histogram, upper);
+    return upper;
+}
+
+void build_palette(const uint32_t* histogram, uint16_t max_colors, adaptive_palette_t& palette) {
+    // the first box is the whole rgb15 cube
+    color_box_t cube{};
+    for (int k = 0; k < 3; k++) {
+        cube.hi[k] = 31;
+    }
+    std::vector<color_box_t> boxes = { cube };
+    measure_box(histogram, boxes[0]);
+    // keep splitting the most populated box that has more than one color
+    while (boxes.size() < max_colors) {
+        int best = -1;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            const color_box_t& box = boxes[i];
+            bool splittable = box.occupied_lo[0] < box.occupied_hi[0] || box.occupied_lo[1] < box.occupied_hi[1] || box.occupied_lo[2] < box.occupied_hi[2];
+            if (splittable && (best < 0 || box.count > boxes[best].count)) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        color_box_t upper = split_box(histogram, boxes[best]);
+        boxes.push_back(upper);
+    }
+
+    // each box's color is the mean of its pixels, and every color in the box maps to it
+    palette.n_colors = boxes.size();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        const color_box_t& box = boxes[i];
+        uint64_t sum[3] = {};
+        uint8_t c[3];
+        for (c[0] = box.lo[0]; c[0] <= box.hi[0]; c[0]++) {
+            for (c[1] = box.lo[1]; c[1] <= box.hi[1]; c[1]++) {
+                for (c[2] = box.lo[2]; c[2] <= box.hi[2]; c[2]++) {
+                    uint16_t color = box_color(c);
+                    uint32_t n = histogram[color];
+                    for (int k = 0; k < 3; k++) {
+                        sum[k] += (uint64_t)n * (c[k] << 3 | c[k] >> 2); // 5 bits widened to 8
+                    }
+                    palette.lookup[color] = i;
+                }
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            uint8_t center = (box.lo[k] + box.hi[k] + 1) * 4; // for an empty box
+            palette.colors[i * 3 + k] = box.count ? (sum[k] + box.count / 2) / box.count : center;
+        }
+    }
+}
+
+void map_to_palette(const uint8_t* rgb, size_t n_pixels, const adaptive_palette_t& palette, uint8_t* indexes) {
+    for (size_t i = 0; i < n_pixels; i++, rgb += 3) {
+        indexes[i] = palette.lookup[rgb15(rgb[0], rgb[1], rgb[2])];
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef QUANTIZE
+#define QUANTIZE
+
+#include <cstddef>
+#include <cstdint>
+
+// colors are counted and looked up at 5 bits per channel, red in the high bits
+#define RGB15_COLORS 32768
+
+inline uint16_t rgb15(uint8_t r, uint8_t g, uint8_t b) {
+    return (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+}
+
+// a palette picked for some images, with the palette index of every 15-bit color
+typedef struct {
+    uint16_t n_colors;
+    uint8_t colors[256 * 3]; // rgb
+    uint8_t lookup[RGB15_COLORS];
+} adaptive_palette_t;
+
+// count the 15-bit colors of packed rgb pixels into histogram, taking every step-th pixel
+void add_to_histogram(const uint8_t* rgb, size_t n_pixels, size_t step, uint32_t* histogram);
+
+// median cut of the histogram into at most max_colors colors
+// the boxes split the whole color cube, so colors missing from the histogram still map to a nearby color
+void build_palette(const uint32_t* histogram, uint16_t max_colors, adaptive_palette_t& palette);
+
+// map packed rgb pixels to palette indexes, one table load each
+void map_to_palette(const uint8_t* rgb, size_t n_pixels, const adaptive_palette_t& palette, uint8_t* indexes);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a fixed set of worker threads taking tasks from a shared queue
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping{};
+
+    void work();
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(size_t n_threads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // runs the queued tasks to completion before joining
+    ~ThreadPool();
+
+    size_t size() const {
+        return this->workers.size();
+    }
+
+    void post(std::function<void()> task);
+
+    template<typename F>
+    auto submit(F&& fn) -> std::future<decltype(fn())> {
+        typedef decltype(fn()) result_t;
+        // std::function needs a copyable callable, so the task is shared
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(fn));
+        std::future<result_t> result = task->get_future();
+        this->post([task]() { (*task)(); });
+        return result;
+    }
+};
+
+#endif